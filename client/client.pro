@@ -1,6 +1,6 @@
 TEMPLATE = app
 TARGET = client
-INCLUDEPATH += .
+INCLUDEPATH += . ../library
 QT += widgets network
 SOURCES += main.cpp
 CONFIG += c++11
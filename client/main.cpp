@@ -3,6 +3,8 @@
 #include <QtNetwork>
 
 #include "snake_generated.h"
+#include "field_delta.hpp"
+#include "field_compact.hpp"
 
 using namespace SnakeGame;
 
@@ -14,7 +16,7 @@ class LoginForm : public QWidget
 	public:
 		LoginForm();
 		QLineEdit *server, *login, *password, *field;
-		QCheckBox *needNoSendPos;
+		QCheckBox *needNoSendPos, *delta, *compact;
 	public slots:
 		void start();
 };
@@ -61,6 +63,8 @@ class GameForm : public QWidget
 		GameWidget *gw;
 		void error(const QString& text);
 		bool needSendPos;
+		bool useDelta;
+		bool useCompact;
 
 	public slots:
 		void sockReadyRead();
@@ -73,6 +77,7 @@ class GameForm : public QWidget
 		void processMessage(const QByteArray& message);
 		void processWelcome(const Welcome* pkg);
 		void processError(const Error* pkg);
+		void processField(const QByteArray& message);
 		void sendPos();
 		void updateInfo();
 		QFile gameBlob;
@@ -80,6 +85,8 @@ class GameForm : public QWidget
 		QLabel *head, *direction, *w, *snakeid, *playerid;
 		QLineEdit *trackSnakeId;
 		QTimer *replayTimer;
+		snake_impl::FieldDecoders decoder;
+		snake_impl::CompactDecoder compactDecoder;
 
 	friend class GameWidget;
 };
@@ -105,6 +112,10 @@ LoginForm::LoginForm()
 	l->addRow("Field", field);
 	needNoSendPos = new QCheckBox("Don't send position");
 	l->addRow(needNoSendPos);
+	delta = new QCheckBox("Delta updates");
+	l->addRow(delta);
+	compact = new QCheckBox("Compact coordinates");
+	l->addRow(compact);
 	setLayout(l);
 	QPushButton *start = new QPushButton("Start");
 	l->addRow(start);
@@ -123,12 +134,16 @@ void LoginForm::start()
 	{
 		x->needSendPos = false;
 	}
+	x->useDelta = delta->isChecked();
+	x->useCompact = compact->isChecked();
 	x->show();
 	deleteLater();
 }
 
 GameForm::GameForm(const QString& s, const QString& _l, const QString& p, const QString& f):
 	needSendPos(true),
+	useDelta(false),
+	useCompact(false),
 	gameBlob("game.blob"),
 	replayTimer(nullptr)
 {
@@ -162,7 +177,7 @@ GameForm::GameForm(const QString& s, const QString& _l, const QString& p, const
 				flatbuffers::FlatBufferBuilder fbb;
 				auto login = fbb.CreateString(_l.toStdString());
 				auto password = fbb.CreateString(p.toStdString());
-				auto w = CreateLogin(fbb, login, password, f.toInt(), level10 ? 10 : 1);
+				auto w = CreateLogin(fbb, login, password, f.toInt(), level10 ? 10 : 1, useDelta, false, useCompact);
 				auto pkg = CreatePackage(fbb, PackageType_Login, w.Union());
 				FinishPackageBuffer(fbb, pkg);
 				sendPackage(fbb);
@@ -380,20 +395,37 @@ void GameForm::processMessage(const QByteArray& message)
 			processError(static_cast<const Error*>(pkg->pkg()));
 		break;
 		case PackageType_Field:
-			gw->fieldBuf = message;
-			gw->repaint();
-			updateInfo();
-			if (can) 
-			{
-				can = false;
-				sendPos();
-			}
+			processField(message);
+		break;
+		case PackageType_FieldDelta:
+		{
+			auto &fbb = decoder.apply(static_cast<const FieldDelta*>(pkg->pkg()));
+			processField(QByteArray(reinterpret_cast<const char*>(fbb.GetBufferPointer()), fbb.GetSize()));
+		}
+		break;
+		case PackageType_CompactField:
+		{
+			auto &fbb = compactDecoder.apply(static_cast<const CompactField*>(pkg->pkg()));
+			processField(QByteArray(reinterpret_cast<const char*>(fbb.GetBufferPointer()), fbb.GetSize()));
+		}
 		break;
 		default:
 			error("Unknown package type arrived: " + QString::number(pkg->pkg_type()));
 	}
 }
 
+void GameForm::processField(const QByteArray& message)
+{
+	gw->fieldBuf = message;
+	gw->repaint();
+	updateInfo();
+	if (can) 
+	{
+		can = false;
+		sendPos();
+	}
+}
+
 void GameForm::processWelcome(const Welcome* pkg)
 {
 	qDebug() << "Authenticated!";
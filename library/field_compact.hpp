@@ -0,0 +1,88 @@
+#ifndef SNAKE_FIELD_COMPACT_H
+#define SNAKE_FIELD_COMPACT_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include "snake_generated.h"
+
+namespace snake_impl
+{
+	/* IEEE 754 half to float */
+	inline float halfToFloat(uint16_t h)
+	{
+		uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16, e = (h >> 10) & 0x1f, m = h & 0x3ff;
+		if (e == 0)
+		{
+			/* Subnormal, counted in 2^-24 units */
+			float v = m / 16777216.0f;
+			return sign ? -v : v;
+		}
+		uint32_t x = sign | (e == 31 ? 0x7f800000 : (e + 112) << 23) | (m << 13);
+		float v;
+		memcpy(&v, &x, sizeof(v));
+		return v;
+	}
+
+	/* Coordinates of a CompactField */
+	class CompactPoints
+	{
+		private:
+			float ox, oy, step;
+
+		public:
+			explicit CompactPoints(const SnakeGame::CompactField* f):
+				ox(f->origin() ? f->origin()->x() : 0), oy(f->origin() ? f->origin()->y() : 0), step(f->step()) {}
+			float x(const SnakeGame::QPoint& p) const { return ox + p.x() * step; }
+			float y(const SnakeGame::QPoint& p) const { return oy + p.y() * step; }
+	};
+
+	/* Rebuilds Field packages from CompactField packages */
+	class CompactDecoder
+	{
+		private:
+			flatbuffers::FlatBufferBuilder fbb;
+			std::vector<SnakeGame::Point> points;
+
+		public:
+			/* The returned builder holds the rebuilt Field package until the next call */
+			const flatbuffers::FlatBufferBuilder& apply(const SnakeGame::CompactField* c)
+			{
+				CompactPoints q(c);
+				fbb.Clear();
+				std::vector<flatbuffers::Offset<SnakeGame::Snake>> outSnakes;
+				if (c->snakes()) for (auto s : *c->snakes())
+				{
+					points.clear();
+					if (s->skeleton()) for (auto p : *s->skeleton())
+					{
+						points.emplace_back(q.x(*p), q.y(*p));
+					}
+					outSnakes.push_back(SnakeGame::CreateSnake(fbb, s->player_id(), s->snake_id(), halfToFloat(s->r()),
+						fbb.CreateVectorOfStructs(points), s->head_visible(), s->boost()));
+				}
+
+				std::vector<SnakeGame::Food> outFoods;
+				if (c->foods()) for (auto i : *c->foods())
+				{
+					outFoods.emplace_back(SnakeGame::Point(q.x(i->p()), q.y(i->p())), halfToFloat(i->w()));
+				}
+
+				std::vector<SnakeGame::OwnSnake> outOwn;
+				if (c->own()) for (auto i : *c->own())
+				{
+					outOwn.push_back(*i);
+				}
+
+				auto f = SnakeGame::CreateField(fbb, c->snake_id(), c->w(), c->time(),
+					fbb.CreateVector(outSnakes), fbb.CreateVectorOfStructs(outFoods), 0, c->tick(),
+					c->own() ? fbb.CreateVectorOfStructs(outOwn) : 0, c->input_tick());
+				auto pkg = SnakeGame::CreatePackage(fbb, SnakeGame::PackageType_Field, f.Union());
+				SnakeGame::FinishPackageBuffer(fbb, pkg);
+				return fbb;
+			}
+	};
+}
+
+#endif
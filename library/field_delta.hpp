@@ -0,0 +1,137 @@
+#ifndef SNAKE_FIELD_DELTA_H
+#define SNAKE_FIELD_DELTA_H
+
+#include <map>
+#include <algorithm>
+#include <vector>
+#include <utility>
+#include <iterator>
+
+#include "snake_generated.h"
+
+namespace snake_impl
+{
+	/* Reconstructs full Field packages from the FieldDelta stream of one connection */
+	class FieldDecoder
+	{
+		private:
+			struct SnakeState
+			{
+				int first;
+				std::vector<SnakeGame::Point> points;
+			};
+			std::map<std::pair<int, int>, SnakeState> snakes;
+			std::map<int, SnakeGame::Food> foods;
+			flatbuffers::FlatBufferBuilder fbb;
+
+		public:
+			/* Applies the delta; the returned builder holds the rebuilt Field package until the next call */
+			const flatbuffers::FlatBufferBuilder& apply(const SnakeGame::FieldDelta* d)
+			{
+				/* Moves are sent in 1/32 units */
+				const float scale = 32;
+				if (d->keyframe())
+				{
+					snakes.clear();
+					foods.clear();
+				}
+				fbb.Clear();
+
+				std::map<std::pair<int, int>, SnakeState> nextSnakes;
+				std::vector<flatbuffers::Offset<SnakeGame::Snake>> outSnakes;
+				if (d->snakes()) for (auto s : *d->snakes())
+				{
+					auto key = std::make_pair(s->player_id(), s->snake_id());
+					SnakeState &cur = nextSnakes[key];
+					cur.first = s->first();
+					cur.points.resize(s->count());
+					int from = cur.first, to = cur.first;
+					auto base = snakes.find(key);
+					if (!s->full() && base != snakes.end())
+					{
+						from = std::max(cur.first, base->second.first);
+						to = std::min(cur.first + s->count(), base->second.first + static_cast<int>(base->second.points.size()));
+					}
+					size_t move = 0, point = 0;
+					for (int k = cur.first; k < cur.first + s->count(); ++k)
+					{
+						if (k >= from && k < to)
+						{
+							const SnakeGame::Point &prev = base->second.points[k - base->second.first];
+							cur.points[k - cur.first] = SnakeGame::Point(prev.x() + s->moves()->Get(move) / scale,
+								prev.y() + s->moves()->Get(move + 1) / scale);
+							move += 2;
+						}
+						else
+						{
+							cur.points[k - cur.first] = *s->points()->Get(point++);
+						}
+					}
+					outSnakes.push_back(SnakeGame::CreateSnake(fbb, s->player_id(), s->snake_id(), s->r(),
+						fbb.CreateVectorOfStructs(cur.points), cur.first == 0, s->boost()));
+				}
+				snakes.swap(nextSnakes);
+
+				if (d->foods_removed()) for (auto i : *d->foods_removed())
+				{
+					foods.erase(i);
+				}
+				if (d->foods_added()) for (auto i : *d->foods_added())
+				{
+					foods[i->id()] = SnakeGame::Food(i->p(), i->w());
+				}
+				std::vector<SnakeGame::Food> outFoods;
+				for (auto &i : foods)
+				{
+					outFoods.push_back(i.second);
+				}
+
+				std::vector<SnakeGame::OwnSnake> outOwn;
+				if (d->own()) for (auto i : *d->own())
+				{
+					outOwn.push_back(*i);
+				}
+
+				auto f = SnakeGame::CreateField(fbb, d->snake_id(), d->w(), d->time(),
+					fbb.CreateVector(outSnakes), fbb.CreateVectorOfStructs(outFoods), 0, d->tick(),
+					d->own() ? fbb.CreateVectorOfStructs(outOwn) : 0, d->input_tick());
+				auto pkg = SnakeGame::CreatePackage(fbb, SnakeGame::PackageType_Field, f.Union());
+				SnakeGame::FinishPackageBuffer(fbb, pkg);
+				return fbb;
+			}
+	};
+
+	/* One FieldDecoder per snake_id, like the baselines of the server. The server sends
+	   every live own snake in every tick it sends, so a snake missing from a whole tick is dead. */
+	class FieldDecoders
+	{
+		private:
+			struct Entry
+			{
+				FieldDecoder decoder;
+				int tick;
+			};
+			std::map<int, Entry> decoders;
+			int tick = -1, prevTick = -1;
+
+		public:
+			/* The returned builder holds the rebuilt Field package until the next call */
+			const flatbuffers::FlatBufferBuilder& apply(const SnakeGame::FieldDelta* d)
+			{
+				if (d->tick() > tick)
+				{
+					prevTick = tick;
+					tick = d->tick();
+					for (auto i = decoders.begin(); i != decoders.end();)
+					{
+						i = i->second.tick < prevTick ? decoders.erase(i) : std::next(i);
+					}
+				}
+				Entry &e = decoders[d->snake_id()];
+				e.tick = d->tick();
+				return e.decoder.apply(d);
+			}
+	};
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef SNAKE_FIELD_VIEW_H
+#define SNAKE_FIELD_VIEW_H
+
+#include <memory>
+#include <vector>
+
+#include "snake_generated.h"
+
+/* Contiguous structs inside a received package */
+template<class T>
+class Span
+{
+	private:
+		const T *b, *e;
+
+	public:
+		template<class V>
+		explicit Span(const V* v): b(v && v->size() ? v->Get(0) : nullptr), e(b ? b + v->size() : nullptr) {}
+		const T* begin() const { return b; }
+		const T* end() const { return e; }
+		size_t size() const { return e - b; }
+		bool empty() const { return b == e; }
+		const T& operator[](size_t i) const { return b[i]; }
+};
+
+/* One snake of a FieldView; skeleton points are SnakeGame::Point with x() and y() */
+class SnakeView
+{
+	private:
+		const SnakeGame::Snake *s;
+
+	public:
+		explicit SnakeView(const SnakeGame::Snake* _s): s(_s) {}
+		int player() const { return s->player_id(); }
+		int id() const { return s->snake_id(); }
+		double r() const { return s->r(); }
+		bool headVisible() const { return s->head_visible(); }
+		bool boost() const { return s->boost(); }
+		Span<SnakeGame::Point> skeleton() const { return Span<SnakeGame::Point>(s->skeleton()); }
+};
+
+/* Read-only view of a received Field without copying it. The view holds the
+   package, so a copy of the view kept past play() keeps the package too. */
+class FieldView
+{
+	private:
+		typedef flatbuffers::Vector<flatbuffers::Offset<SnakeGame::Snake>> SnakeVector;
+		const SnakeGame::Field *f;
+		std::shared_ptr<const std::vector<char>> package;
+
+	public:
+		class Snakes
+		{
+			private:
+				const SnakeVector *v;
+
+			public:
+				class iterator
+				{
+					private:
+						const SnakeVector *v;
+						flatbuffers::uoffset_t i;
+
+					public:
+						iterator(const SnakeVector* _v, flatbuffers::uoffset_t _i): v(_v), i(_i) {}
+						SnakeView operator*() const { return SnakeView(v->Get(i)); }
+						iterator& operator++() { ++i; return *this; }
+						bool operator!=(const iterator& o) const { return i != o.i; }
+						bool operator==(const iterator& o) const { return i == o.i; }
+				};
+
+				explicit Snakes(const SnakeVector* _v): v(_v) {}
+				size_t size() const { return v ? v->size() : 0; }
+				SnakeView operator[](size_t i) const { return SnakeView(v->Get(i)); }
+				iterator begin() const { return iterator(v, 0); }
+				iterator end() const { return iterator(v, size()); }
+		};
+
+		FieldView(const SnakeGame::Field* _f, const std::shared_ptr<const std::vector<char>>& _package):
+			f(_f), package(_package) {}
+		int id() const { return f->snake_id(); }
+		double w() const { return f->w(); }
+		double time() const { return f->time(); }
+		int tick() const { return f->tick(); }
+		Snakes snakes() const { return Snakes(f->snakes()); }
+		/* Foods are SnakeGame::Food: p() and w() */
+		Span<SnakeGame::Food> foods() const { return Span<SnakeGame::Food>(f->foods()); }
+		Span<SnakeGame::Segment> borders() const { return Span<SnakeGame::Segment>(f->borders()); }
+		/* Only with SLITHERIO_BUNDLE */
+		Span<SnakeGame::OwnSnake> own() const { return Span<SnakeGame::OwnSnake>(f->own()); }
+		const SnakeGame::Field* raw() const { return f; }
+};
+
+#endif
@@ -6,16 +6,68 @@
 #include <utility>
 #include <sstream>
 #include <iostream>
-#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <map>
 
 #include "snake_generated.h"
+#include "field_delta.hpp"
+#include "field_view.hpp"
+#include "field_compact.hpp"
+
+/* Define SLITHERIO_DELTA to true before including the library to receive compact
+   FieldDelta updates; they are decoded back into Field transparently */
+#ifndef SLITHERIO_DELTA
+#define SLITHERIO_DELTA false
+#endif
+
+/* Define SLITHERIO_COMPACT to true to receive CompactField packages with quantized
+   coordinates, about half the size of Field; they are decoded transparently.
+   Coordinates are then rounded to steps of at most 1/16384 of the view radius. Ignored with SLITHERIO_DELTA */
+#ifndef SLITHERIO_COMPACT
+#define SLITHERIO_COMPACT false
+#endif
+
+/* Define SLITHERIO_BUNDLE to true to get one Field per tick for all snakes of the
+   player, listed in Field::own, and steer all of them from one play(field, moves) */
+#ifndef SLITHERIO_BUNDLE
+#define SLITHERIO_BUNDLE false
+#endif
+
+/* Define SLITHERIO_VIEW to true to get a FieldView over the received package
+   in play() instead of a copied Field */
+#ifndef SLITHERIO_VIEW
+#define SLITHERIO_VIEW false
+#endif
+
+/* Define SLITHERIO_STATS to true to print play() durations and dropped frames on exit */
+#ifndef SLITHERIO_STATS
+#define SLITHERIO_STATS false
+#endif
 
 struct Configuration
 {
 	int player;
 	double k10;
+	int tickMs; /* Time between two ticks */
 } configuration; 
 
+/* The frame play() is called with */
+struct FrameInfo
+{
+	int tick; /* Server tick of the field */
+	std::chrono::steady_clock::time_point received;
+	/* Estimated round trip: from sending a direction to the first field after the server got it */
+	std::chrono::microseconds rtt;
+	/* Directions sent after this probably miss the next tick */
+	std::chrono::steady_clock::time_point deadline;
+} frameInfo;
+
 struct Point {
     Point(double _x = 0, double _y = 0): x(_x), y(_y) {}
 	double x, y;
@@ -35,6 +87,11 @@ struct Snake {
     bool boost;
 };
 
+struct OwnSnake {
+	int id;
+	double w;
+};
+
 struct Field {
 	int id;
 	double w;
@@ -42,9 +99,28 @@ struct Field {
 	std::vector<Snake> snakes;
 	std::vector<Food> foods;
 	std::vector<std::pair<Point, Point>> borders;
+	std::vector<OwnSnake> own; /* Only with SLITHERIO_BUNDLE */
 };
 
-Point play(const Field& field, bool &boost, bool &split);
+/* Where one own snake goes; moves[i] is for field.own[i] and starts at its head */
+struct Move {
+	int id;
+	Point p;
+	bool boost;
+	bool split;
+};
+
+#if SLITHERIO_VIEW
+typedef FieldView PlayField;
+#else
+typedef Field PlayField;
+#endif
+
+#if SLITHERIO_BUNDLE
+void play(const PlayField& field, std::vector<Move>& moves);
+#else
+Point play(const PlayField& field, bool &boost, bool &split);
+#endif
 
 namespace snake_impl
 {   
@@ -67,7 +143,36 @@ namespace snake_impl
             string hostname, port, login, password;
             tcp::socket sock;
             int field;
-            atomic<bool> isBusy;
+            FieldDecoders decoder;
+            CompactDecoder compactDecoder;
+            /* Receive buffers; a FieldView may still hold the previous one */
+            shared_ptr<vector<char>> message, rebuilt;
+            flatbuffers::FlatBufferBuilder reply;
+
+            /* The strategy thread plays the latest frame of every own snake, taking snake ids
+               round-robin so that a slow play() starves none of them; a newer frame replaces
+               one of the same snake it has not taken yet */
+            struct PendingFrame
+            {
+                shared_ptr<const PlayField> field;
+                FrameInfo info;
+            };
+            thread strategy;
+            mutex frameMutex;
+            condition_variable frameCv;
+            map<int, PendingFrame> frames;
+            /* Snake of the frame played last */
+            int lastPlayed = -1;
+            bool stopping = false;
+
+            /* Written by the reader under frameMutex */
+            int lastTick = -1;
+            std::chrono::microseconds rtt{0};
+            long dropped = 0, skipped = 0;
+            /* Ticks of recent directions and when they were sent, by tick modulo the size */
+            pair<int, std::chrono::steady_clock::time_point> sent[8];
+            /* Written by the strategy thread */
+            vector<uint32_t> playUs;
 		public:
 			Client(const string& _s, const string& _l, const string& _p, int _f):
 				login(_l), password(_p), field(_f),
@@ -77,6 +182,15 @@ namespace snake_impl
 				getline(srvss, hostname, ':');
 				srvss >> port;
 				dlog() << "hostname=" << hostname << " port=" << port;
+				for (auto &i : sent)
+				{
+					i.first = -1;
+				}
+			}
+
+			~Client()
+			{
+				stop();
 			}
 
 			int run()
@@ -90,11 +204,12 @@ namespace snake_impl
                         flatbuffers::FlatBufferBuilder fbb;
                         auto login = fbb.CreateString(this->login);
                         auto password = fbb.CreateString(this->password);
-                        auto w = SnakeGame::CreateLogin(fbb, login, password, field);
+                        auto w = SnakeGame::CreateLogin(fbb, login, password, field, 1, SLITHERIO_DELTA, SLITHERIO_BUNDLE, SLITHERIO_COMPACT);
                         auto pkg = SnakeGame::CreatePackage(fbb, SnakeGame::PackageType_Login, w.Union());
                         SnakeGame::FinishPackageBuffer(fbb, pkg);
                         send(fbb);
                     }
+                    strategy = thread([this]() { strategyLoop(); });
                     for (;;)
                     {
                         uint32_t msglen;
@@ -104,9 +219,9 @@ namespace snake_impl
                             + msglen_buf[1]) * 256
                             + msglen_buf[2]) * 256
                             + msglen_buf[3];
-                        vector<char> message(msglen);
-                        read(sock, buffer(message));
-                        auto pkg = SnakeGame::GetPackage(message.data());
+                        read(sock, buffer(reuse(message, msglen)));
+                        auto received = std::chrono::steady_clock::now();
+                        auto pkg = SnakeGame::GetPackage(message->data());
                         switch (pkg->pkg_type())
                         {
                             case SnakeGame::PackageType_Welcome:
@@ -114,40 +229,34 @@ namespace snake_impl
                                 auto welcome = static_cast<const SnakeGame::Welcome*>(pkg->pkg());
                                 configuration.k10 = welcome->k10();
                                 configuration.player = welcome->player_id();
+                                configuration.tickMs = welcome->tick_ms();
                             }
                             break;
                             case SnakeGame::PackageType_Field:
+                                onField(static_cast<const SnakeGame::Field*>(pkg->pkg()), message, received);
+                            break;
+                            case SnakeGame::PackageType_FieldDelta:
+                            {
+                                auto &fbb = decoder.apply(static_cast<const SnakeGame::FieldDelta*>(pkg->pkg()));
+                                auto data = reinterpret_cast<const char*>(fbb.GetBufferPointer());
+#if SLITHERIO_VIEW
+                                /* The decoder reuses its builder, a view needs a copy of its own */
+                                data = static_cast<const char*>(memcpy(reuse(rebuilt, fbb.GetSize()).data(), data, fbb.GetSize()));
+#endif
+                                onField(static_cast<const SnakeGame::Field*>(SnakeGame::GetPackage(data)->pkg()), rebuilt, received);
+                            }
+                            break;
+                            case SnakeGame::PackageType_CompactField:
                             {
-                                if (isBusy)
-                                {
-                                    dlog() << "Frame dropped :-(";
-                                }
-                                else
-                                {
-                                    auto field = static_cast<const SnakeGame::Field*>(pkg->pkg());
-                                    auto myField = f2f(field);
-                                    isBusy = true;
-                                    async(launch::async, [this, myField]()
-                                        {
-                                            bool boost = false;
-                                            for (auto &i : myField.snakes)
-                                            {
-                                                if (i.player == configuration.player && i.id == myField.id)
-                                                {
-                                                    boost = i.boost;
-                                                }
-                                            }
-                                            bool split = false;
-                                            Point ret = play(myField, boost, split);
-                                            isBusy = false;
-                                            flatbuffers::FlatBufferBuilder fbb;
-                                            auto point = SnakeGame::Point(ret.x, ret.y);
-                                            auto d = SnakeGame::CreateDirection(fbb, myField.id, &point, boost, split);
-                                            auto pkg = SnakeGame::CreatePackage(fbb, SnakeGame::PackageType_Direction, d.Union());
-                                            SnakeGame::FinishPackageBuffer(fbb, pkg);
-                                            send(fbb);
-                                        });
-                                }
+                                auto compact = static_cast<const SnakeGame::CompactField*>(pkg->pkg());
+#if SLITHERIO_VIEW
+                                /* A view reads Field packages, so it gets a rebuilt one */
+                                auto &fbb = compactDecoder.apply(compact);
+                                auto data = static_cast<const char*>(memcpy(reuse(rebuilt, fbb.GetSize()).data(), fbb.GetBufferPointer(), fbb.GetSize()));
+                                onField(static_cast<const SnakeGame::Field*>(SnakeGame::GetPackage(data)->pkg()), rebuilt, received);
+#else
+                                onField(compact, nullptr, received);
+#endif
                             }
                             break;
                             case SnakeGame::PackageType_Error:
@@ -164,13 +273,206 @@ namespace snake_impl
                 catch (exception& e)
                 {
                     dlog() << "Local error: " << e.what();
+                    stop();
                     return 1;
                 }
+                stop();
                 return 0;
 			}
 
+            void stop()
+            {
+                {
+                    lock_guard<mutex> lg(frameMutex);
+                    stopping = true;
+                }
+                frameCv.notify_all();
+                if (strategy.joinable())
+                {
+                    strategy.join();
+#if SLITHERIO_STATS
+                    printStats();
+#endif
+                }
+            }
+
+            void printStats()
+            {
+                sort(playUs.begin(), playUs.end());
+                auto at = [this](double q) { return playUs.empty() ? 0 : playUs[static_cast<size_t>(q * (playUs.size() - 1))]; };
+                dlog() << "frames played " << playUs.size() << ", dropped " << dropped << ", ticks not sent by the server " << skipped;
+                dlog() << "play() us: p50 " << at(0.5) << " p90 " << at(0.9) << " p99 " << at(0.99) << " max " << at(1);
+                dlog() << "rtt us " << rtt.count();
+            }
+
+            /* Sized for the next package; a buffer still held by a FieldView is left to it */
+            static vector<char>& reuse(shared_ptr<vector<char>>& buf, size_t size)
+            {
+                if (!buf || buf.use_count() > 1)
+                {
+                    buf = make_shared<vector<char>>();
+                }
+                buf->resize(size);
+                return *buf;
+            }
+
+
+
+
+            /* package owns field; it may be null when nothing refers to field after the call.
+               F is SnakeGame::Field, or SnakeGame::CompactField without SLITHERIO_VIEW */
+            template<class F>
+            void onField(const F *field, const shared_ptr<const vector<char>>& package,
+                std::chrono::steady_clock::time_point received)
+            {
+#if SLITHERIO_VIEW
+                auto next = make_shared<const FieldView>(field, package);
+#else
+                auto next = make_shared<const Field>(f2f(field));
+#endif
+                bool replaced;
+                {
+                    lock_guard<mutex> lg(frameMutex);
+                    if (lastTick >= 0 && field->tick() > lastTick + 1)
+                    {
+                        skipped += field->tick() - lastTick - 1;
+                    }
+                    lastTick = field->tick();
+                    int input = field->input_tick();
+                    auto &s = sent[(input >= 0 ? input : 0) % 8];
+                    if (input >= 0 && s.first == input)
+                    {
+                        auto sample = std::chrono::duration_cast<std::chrono::microseconds>(received - s.second);
+                        rtt = rtt.count() ? rtt + (sample - rtt) / 8 : sample;
+                        s.first = -1;
+                    }
+
+                    /* Without a bundle every own snake gets a Field of its own each tick */
+                    PendingFrame &pending = frames[field->snake_id()];
+                    replaced = bool(pending.field);
+                    dropped += replaced;
+                    pending.field = move(next);
+                    pending.info.tick = field->tick();
+                    pending.info.received = received;
+                    pending.info.rtt = rtt;
+                    pending.info.deadline = max(received, received + std::chrono::milliseconds(configuration.tickMs) - rtt);
+                }
+                frameCv.notify_one();
+                if (replaced)
+                {
+                    dlog() << "Frame dropped :-(";
+                }
+            }
+
+            /* Runs on the strategy thread; a frame whose play() or reply fails is logged and skipped */
+            void strategyLoop()
+            {
+                for (;;)
+                {
+                    shared_ptr<const PlayField> f;
+                    {
+                        unique_lock<mutex> l(frameMutex);
+                        frameCv.wait(l, [this]() { return stopping || !frames.empty(); });
+                        if (stopping)
+                        {
+                            return;
+                        }
+                        auto next = frames.upper_bound(lastPlayed);
+                        if (next == frames.end())
+                        {
+                            next = frames.begin();
+                        }
+                        lastPlayed = next->first;
+                        f.swap(next->second.field);
+                        frameInfo = next->second.info;
+                        frames.erase(next);
+                    }
+                    try
+                    {
+#if SLITHERIO_STATS
+                        auto start = std::chrono::steady_clock::now();
+#endif
+                        auto moves = startMoves(*f);
+#if SLITHERIO_BUNDLE
+                        play(*f, moves);
+#else
+                        Move &m = moves[0];
+                        m.p = play(*f, m.boost, m.split);
+#endif
+#if SLITHERIO_STATS
+                        playUs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+#endif
+                        {
+                            lock_guard<mutex> lg(frameMutex);
+                            sent[frameInfo.tick % 8] = make_pair(frameInfo.tick, std::chrono::steady_clock::now());
+                        }
+                        for (auto &m : moves)
+                        {
+                            sendDirection(m.id, m.p, m.boost, m.split, frameInfo.tick);
+                        }
+                    }
+                    catch (exception& e)
+                    {
+                        dlog() << "Strategy error: " << e.what();
+                    }
+                }
+            }
+
+            /* One move per own snake in bundle mode, else for field.id; each starts at the head of its snake */
+            static vector<Move> startMoves(const Field& f)
+            {
+                vector<Move> moves;
+#if SLITHERIO_BUNDLE
+                for (auto &o : f.own)
+                {
+                    moves.push_back(Move{o.id, Point(), false, false});
+                }
+#else
+                moves.push_back(Move{f.id, Point(), false, false});
+#endif
+                for (auto &m : moves) for (auto &i : f.snakes)
+                {
+                    if (i.player == configuration.player && i.id == m.id && i.headVisible)
+                    {
+                        m.p = i.skeleton[0];
+                        m.boost = i.boost;
+                    }
+                }
+                return moves;
+            }
 
+            static vector<Move> startMoves(const FieldView& f)
+            {
+                vector<Move> moves;
+#if SLITHERIO_BUNDLE
+                for (auto &o : f.own())
+                {
+                    moves.push_back(Move{o.snake_id(), Point(), false, false});
+                }
+#else
+                moves.push_back(Move{f.id(), Point(), false, false});
+#endif
+                for (auto &m : moves) for (auto i : f.snakes())
+                {
+                    if (i.player() == configuration.player && i.id() == m.id && i.headVisible())
+                    {
+                        m.p = Point(i.skeleton()[0].x(), i.skeleton()[0].y());
+                        m.boost = i.boost();
+                    }
+                }
+                return moves;
+            }
 
+            /* Only the strategy thread sends directions, so the builder is reused */
+            void sendDirection(int id, Point p, bool boost, bool split, int tick)
+            {
+                reply.Clear();
+                auto point = SnakeGame::Point(p.x, p.y);
+                auto d = SnakeGame::CreateDirection(reply, id, &point, boost, split, tick);
+                auto pkg = SnakeGame::CreatePackage(reply, SnakeGame::PackageType_Direction, d.Union());
+                SnakeGame::FinishPackageBuffer(reply, pkg);
+                send(reply);
+            }
 
             void send(const flatbuffers::FlatBufferBuilder& fbb)
             {
@@ -179,6 +481,44 @@ namespace snake_impl
                 write(sock, buffer(fbb.GetBufferPointer(), fbb.GetSize()));
             }
 
+            Field f2f(const SnakeGame::CompactField *f)
+            {
+                Field ret;
+                CompactPoints q(f);
+                ret.id = f->snake_id();
+                ret.w = f->w();
+                ret.time = f->time();
+                if (f->snakes()) for (auto i : *f->snakes())
+                {
+                    Snake cur;
+                    cur.player = i->player_id();
+                    cur.id = i->snake_id();
+                    cur.r = halfToFloat(i->r());
+                    cur.skeleton.reserve(i->skeleton()->size());
+                    for (auto j : *i->skeleton())
+                    {
+                        cur.skeleton.emplace_back(q.x(*j), q.y(*j));
+                    }
+                    cur.headVisible = i->head_visible();
+                    cur.boost = i->boost();
+                    ret.snakes.emplace_back(move(cur));
+                }
+                if (f->foods()) for (auto i : *f->foods())
+                {
+                    Food cur;
+                    cur.p.x = q.x(i->p());
+                    cur.p.y = q.y(i->p());
+                    cur.w = halfToFloat(i->w());
+                    ret.foods.emplace_back(cur);
+                }
+
+                if (f->own()) for (auto i : *f->own())
+                {
+                    ret.own.push_back(OwnSnake{i->snake_id(), i->w()});
+                }
+                return ret;
+            }
+
             Field f2f(const SnakeGame::Field *f)
             {
                 Field ret;
@@ -213,6 +553,11 @@ namespace snake_impl
                     ret.borders.emplace_back(Point(i->first().x(), i->first().y()),
                         Point(i->second().x(), i->second().y()));
                 }
+
+                if (f->own()) for (auto i : *f->own())
+                {
+                    ret.own.push_back(OwnSnake{i->snake_id(), i->w()});
+                }
                 return ret;
             }
 	};
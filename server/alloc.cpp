@@ -1,4 +1,5 @@
 #include "alloc.hpp"
+#include <algorithm>
 
 using namespace mem;
 
@@ -23,6 +24,23 @@ arena::arena(size_t _advise, size_t _chunk_size):
 {
 }
 
+arena::arena(const std::shared_ptr<arena_pool>& _pool, size_t _advise):
+	chunk_size(_advise / 8),
+	total(0),
+	pool(_pool),
+	first(pool->acquire(_advise + chunk_size)),
+	current(first.get())
+{
+}
+
+arena::~arena()
+{
+	if (pool)
+	{
+		pool->release(std::move(first));
+	}
+}
+
 size_t arena::get_total() const
 {
 	return total;
@@ -50,8 +68,64 @@ void* arena::alloc_mem(size_t size, size_t align)
 	return reinterpret_cast<void*>(aligned_pos);
 }
 
+bool arena::extend(void *p, size_t old_size, size_t new_size)
+{
+	char *top = static_cast<char*>(p) + old_size;
+	if (!p || top != current->pos || new_size - old_size > static_cast<size_t>(current->end - current->pos))
+	{
+		return false;
+	}
+	current->pos += new_size - old_size;
+	total += new_size - old_size;
+	return true;
+}
+
 void arena::grow(size_t size)
 {
 	current->next.reset(new chunk(chunk_size >= size ? chunk_size : size));
 	current = current->next.get();
 }
+
+/* Blocks kept for reuse; a game needs about as many as fields alive at once */
+static const size_t max_free_chunks = 8;
+
+arena_pool::arena_pool():
+	high_water(0)
+{
+}
+
+std::unique_ptr<chunk> arena_pool::acquire(size_t size)
+{
+	{
+		std::lock_guard<std::mutex> lg(m);
+		for (auto i = free_chunks.begin(); i != free_chunks.end(); ++i)
+		{
+			if ((*i)->capacity() >= size)
+			{
+				std::unique_ptr<chunk> ret = std::move(*i);
+				free_chunks.erase(i);
+				return ret;
+			}
+		}
+		size = std::max(size, high_water + high_water / 8);
+	}
+	return std::unique_ptr<chunk>(new chunk(size));
+}
+
+void arena_pool::release(std::unique_ptr<chunk> first)
+{
+	size_t used = 0;
+	for (chunk *i = first.get(); i; i = i->next.get())
+	{
+		used += i->used();
+	}
+
+	std::lock_guard<std::mutex> lg(m);
+	/* Decays slowly, so one quiet tick does not shrink the blocks */
+	high_water = std::max(used, high_water - high_water / 16);
+	if (!first->next && first->capacity() >= high_water && free_chunks.size() < max_free_chunks)
+	{
+		first->pos = first->memory.get();
+		free_chunks.push_back(std::move(first));
+	}
+}
@@ -1,8 +1,11 @@
-#ifndef ALLOC_H
+#ifndef ALLOC_HPP
+#define ALLOC_HPP
 
 #include <memory>
 #include <cassert>
 #include <stdexcept>
+#include <mutex>
+#include <vector>
 
 namespace mem
 {
@@ -17,6 +20,23 @@ namespace mem
 		std::unique_ptr<char, chunk_deleter> memory;
 		char *pos, *end;
 		std::unique_ptr<chunk> next;
+		size_t capacity() const { return end - memory.get(); }
+		size_t used() const { return pos - memory.get(); }
+	};
+
+	/* Keeps the memory of destroyed arenas for reuse. Arenas that had to grow are
+	   freed, and the next one gets a single block sized from the high-water mark. */
+	class arena_pool
+	{
+		private:
+			std::mutex m;
+			std::vector<std::unique_ptr<chunk>> free_chunks;
+			size_t high_water;
+
+		public:
+			arena_pool();
+			std::unique_ptr<chunk> acquire(size_t size);
+			void release(std::unique_ptr<chunk> first);
 	};
 
 	class arena
@@ -24,17 +44,23 @@ namespace mem
 		private:
 			size_t chunk_size;
 			size_t total;
+			std::shared_ptr<arena_pool> pool;
 			std::unique_ptr<chunk> first;
 			chunk *current;
 			
 		public:
 			arena(size_t _advise, size_t _chunk_size = 0);
+			arena(const std::shared_ptr<arena_pool>& _pool, size_t _advise);
+			~arena();
 			size_t get_total() const;
 
 			void grow(size_t size);
 
 			void *alloc_mem(size_t size, size_t align);
 
+			/* Grows the allocation at p in place; only possible at the top of the current chunk */
+			bool extend(void *p, size_t old_size, size_t new_size);
+
 			template<class T, class... Args>
 			T* alloc(Args&&... args)
 			{
@@ -91,6 +117,13 @@ namespace mem
 			{
 			}
 
+			/* View of storage already allocated in an arena */
+			dynarr(T* _data, size_t _size):
+				m_size(_size),
+				m_data(_data)
+			{
+			}
+
 			dynarr(arena& _arena, const dynarr<T>& other):
 				m_size(other.size()),
 				m_data(_arena.alloc_array_copy(other.data(), other.size()))
@@ -107,16 +140,28 @@ namespace mem
 				m_data = _arena.alloc_array<T>(m_size);
 			}
 
+			/* Grows in place at the top of the arena, by copying otherwise */
 			void realloc(arena& _arena, size_t size)
 			{
 				if (size <= m_size)
 				{
 					m_size = size;
+					return;
+				}
+				if (!_arena.extend(m_data, sizeof(T) * m_size, sizeof(T) * size))
+				{
+					T *data = static_cast<T*>(_arena.alloc_mem(sizeof(T) * size, alignof(T)));
+					for (size_t i = 0; i < m_size; ++i)
+					{
+						new (data + i) T(std::move(m_data[i]));
+					}
+					m_data = data;
 				}
-				else
+				for (size_t i = m_size; i < size; ++i)
 				{
-					throw std::runtime_error("Not implemented yet!");
+					new (m_data + i) T();
 				}
+				m_size = size;
 			}
 
 			size_t size() const { return m_size; }
@@ -132,6 +177,67 @@ namespace mem
 
 	template<class T> T* begin(dynarr<T>& arr) { return arr.begin(); }
 	template<class T> T* end(dynarr<T>& arr) { return arr.end(); }
+
+	/* Array with push_back in an arena; abandoned storage is reclaimed with the arena */
+	template<class T>
+	class arena_vector
+	{
+		private:
+			arena *m_arena;
+			size_t m_size, m_capacity;
+			T* m_data;
+
+		public:
+			explicit arena_vector(arena& _arena, size_t _capacity = 0):
+				m_arena(&_arena),
+				m_size(0),
+				m_capacity(_capacity),
+				m_data(static_cast<T*>(_arena.alloc_mem(sizeof(T) * _capacity, alignof(T))))
+			{
+			}
+
+			void reserve(size_t capacity)
+			{
+				if (capacity <= m_capacity)
+				{
+					return;
+				}
+				if (!m_arena->extend(m_data, sizeof(T) * m_capacity, sizeof(T) * capacity))
+				{
+					T *data = static_cast<T*>(m_arena->alloc_mem(sizeof(T) * capacity, alignof(T)));
+					for (size_t i = 0; i < m_size; ++i)
+					{
+						new (data + i) T(std::move(m_data[i]));
+					}
+					m_data = data;
+				}
+				m_capacity = capacity;
+			}
+
+			template<class... Args>
+			void emplace_back(Args&&... args)
+			{
+				if (m_size == m_capacity)
+				{
+					reserve(m_capacity < 8 ? 16 : m_capacity * 2);
+				}
+				new (m_data + m_size++) T(std::forward<Args>(args)...);
+			}
+
+			void push_back(const T& v) { emplace_back(v); }
+			void clear() { m_size = 0; }
+
+			size_t size() const { return m_size; }
+			bool empty() const { return !m_size; }
+			T* data() { return m_data; }
+			const T* data() const { return m_data; }
+			T& operator[](size_t idx) { return m_data[idx]; }
+			const T& operator[](size_t idx) const { return m_data[idx]; }
+			T* begin() { return m_data; }
+			T* end() { return m_data + m_size; }
+			const T* begin() const { return m_data; }
+			const T* end() const { return m_data + m_size; }
+	};
 }
 
 #endif
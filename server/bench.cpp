@@ -0,0 +1,322 @@
+#include "game.hpp"
+#include "replay.hpp"
+#include "mailbox.hpp"
+#include "common.hpp"
+#include <boost/log/expressions.hpp>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <thread>
+#include <condition_variable>
+#include <sys/stat.h>
+
+using namespace game_logic;
+using namespace std;
+
+/* Headless harness: drives game::tick as fast as possible, every snake steered by a seeded random bot.
+   bench [options] [ticks] [snake counts...]
+	-j N       run the parallel tick phases on N threads
+	--seed S   seed the game with S and the bots with S + snakes (default: the game default, snakes)
+	--foods N  keep at least N foods on the field
+	--split N  a steering bot asks to split with probability 1/N
+	--joins N  N more players join every 64 ticks
+	--check    run every scenario again with a different number of threads and compare all field hashes
+	--slow-reader MS
+	           a subscriber takes fields through a connection mailbox and spends MS ms on each;
+	           it must get increasing ticks and the last field of the run
+	--record D record every scenario to the directory D/snakes.N */
+struct options
+{
+	shared_ptr<task_pool> pool;
+	bool seeded = false;
+	uint64_t seed = 0;
+	int foods = -1;
+	int split = 0;
+	int joins = 0;
+	bool check = false;
+	int slow_reader = -1;
+	string record;
+	int ticks = 200;
+	vector<int> counts;
+};
+
+struct result
+{
+	int alive_avg;
+	size_t foods;
+	uint64_t arena_max;
+	double total_ms, max_ms;
+	/* The final field, and all fields of the run folded together */
+	uint64_t hash, run_hash;
+	string phases;
+	/* Of the slow reader: fields taken, ticks it skipped, and whether it saw them in order up to the last one */
+	int reader_fields, reader_skipped;
+	bool reader_ok;
+};
+
+/* Takes fields like a connection whose writes take delay each */
+class slow_reader : public game_logic::field_subscriber
+{
+	public:
+		explicit slow_reader(chrono::milliseconds _delay):
+			delay(_delay), thread([this]() { run(); })
+		{
+		}
+
+		void on_field(const shared_ptr<field>& f) override
+		{
+			if (mailbox.put(f))
+			{
+				lock_guard<mutex> lg(m);
+				woken = true;
+				cv.notify_one();
+			}
+		}
+
+		/* Waits until the last field is taken */
+		void finish()
+		{
+			{
+				lock_guard<mutex> lg(m);
+				stop = true;
+			}
+			cv.notify_one();
+			thread.join();
+		}
+
+		int fields = 0, skipped = 0, last_tick = -1;
+		bool ordered = true;
+
+	private:
+		chrono::milliseconds delay;
+		network::field_mailbox mailbox;
+		mutex m;
+		condition_variable cv;
+		bool woken = false, stop = false;
+		std::thread thread;
+
+		void run()
+		{
+			for (;;)
+			{
+				{
+					unique_lock<mutex> l(m);
+					cv.wait(l, [this]() { return woken || stop; });
+					woken = false;
+				}
+				auto f = mailbox.take();
+				if (!f)
+				{
+					if (stop)
+					{
+						return;
+					}
+					continue;
+				}
+				ordered = ordered && f->tick > last_tick;
+				if (last_tick >= 0)
+				{
+					skipped += f->tick - last_tick - 1;
+				}
+				last_tick = f->tick;
+				++fields;
+				/* The write completion looks at the mailbox again */
+				this_thread::sleep_for(delay);
+				lock_guard<mutex> lg(m);
+				woken = true;
+			}
+		}
+};
+
+static result run(const options& o, int snakes, const shared_ptr<task_pool>& pool, bool record)
+{
+	auto cfg = default_configuration();
+	if (o.seeded)
+	{
+		cfg.seed = o.seed;
+	}
+	if (o.foods >= 0)
+	{
+		cfg.min_foods = o.foods;
+	}
+	game g(cfg);
+	g.set_task_pool(pool);
+	g.game_started = true;
+	if (record)
+	{
+		/* A headless run ticks faster than any disk, so it waits for the writer at the end */
+		g.set_recorder(make_shared<replay::writer>(o.record + "/snakes." + to_string(snakes), cfg, true, SIZE_MAX));
+	}
+	shared_ptr<slow_reader> reader;
+	if (o.slow_reader >= 0)
+	{
+		reader = make_shared<slow_reader>(chrono::milliseconds(o.slow_reader));
+		g.subscribe(reader);
+	}
+	for (int i = 0; i < snakes; ++i)
+	{
+		g.get_player("bot" + to_string(i));
+	}
+	mt19937 bot_rng(o.seeded ? o.seed + snakes : snakes);
+	normal_distribution<float> target(0, 100);
+	result r = result();
+	long alive = 0;
+	int joined = 0;
+	for (int t = 0; t < o.ticks; ++t)
+	{
+		auto f = g.get_current_field();
+		for (auto &i : f->snakes)
+		{
+			if ((t + i.id) % 16 == 0)
+			{
+				direction d;
+				d.p = point(target(bot_rng), target(bot_rng));
+				d.boost = bot_rng() % 8 == 0;
+				d.split = o.split && bot_rng() % o.split == 0;
+				g.set_direction(i.p, i.id, d);
+			}
+		}
+		if (t && t % 64 == 0)
+		{
+			for (int i = 0; i < o.joins; ++i)
+			{
+				g.get_player("join" + to_string(joined++));
+			}
+		}
+		alive += f->snakes.size();
+		auto start = chrono::steady_clock::now();
+		g.tick();
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		r.total_ms += ms;
+		r.max_ms = max(r.max_ms, ms);
+		r.arena_max = max<uint64_t>(r.arena_max, g.get_metrics().arena_bytes);
+		r.run_hash = (r.run_hash ^ g.get_current_field()->hash()) * 1099511628211ULL;
+	}
+	auto f = g.get_current_field();
+	r.alive_avg = alive / o.ticks;
+	r.foods = f->foods.size();
+	r.hash = f->hash();
+	if (reader)
+	{
+		reader->finish();
+		r.reader_fields = reader->fields;
+		r.reader_skipped = reader->skipped;
+		r.reader_ok = reader->ordered && reader->last_tick == f->tick;
+	}
+
+	ostringstream phases;
+	auto &m = g.get_metrics();
+	phases << "tick_us=" << m.tick_us.percentile(0.5) << "/" << m.tick_us.percentile(0.99);
+	for (int p = 0; p < tick_metrics::phases; ++p)
+	{
+		phases << " " << tick_metrics::phase_name(p) << "_us="
+			<< m.phase_us[p].percentile(0.5) << "/" << m.phase_us[p].percentile(0.99);
+	}
+	r.phases = phases.str();
+	return r;
+}
+
+int main(int ac, char** av)
+{
+	boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+	options o;
+	int arg = 1;
+	for (; arg < ac && av[arg][0] == '-'; ++arg)
+	{
+		string name = av[arg];
+		if (name == "--check")
+		{
+			o.check = true;
+			continue;
+		}
+		if (arg + 1 >= ac)
+		{
+			cerr << "Missing value of " << name << endl;
+			return 2;
+		}
+		const char *value = av[++arg];
+		if (name == "-j")
+		{
+			o.pool = make_shared<task_pool>(max(1, atoi(value)));
+		}
+		else if (name == "--seed")
+		{
+			o.seeded = true;
+			o.seed = strtoull(value, nullptr, 0);
+		}
+		else if (name == "--foods")
+		{
+			o.foods = atoi(value);
+		}
+		else if (name == "--split")
+		{
+			o.split = max(0, atoi(value));
+		}
+		else if (name == "--joins")
+		{
+			o.joins = max(0, atoi(value));
+		}
+		else if (name == "--slow-reader")
+		{
+			o.slow_reader = max(0, atoi(value));
+		}
+		else if (name == "--record")
+		{
+			o.record = value;
+		}
+		else
+		{
+			cerr << "Unknown option " << name << endl;
+			return 2;
+		}
+	}
+	o.ticks = arg < ac ? max(1, atoi(av[arg++])) : 200;
+	for (; arg < ac; ++arg)
+	{
+		o.counts.push_back(atoi(av[arg]));
+	}
+	if (o.counts.empty())
+	{
+		o.counts = {10, 50, 100, 200, 400, 800};
+	}
+
+	if (!o.record.empty())
+	{
+		mkdir(o.record.c_str(), 0755);
+	}
+
+	/* A serial run checks a parallel one and the other way round */
+	shared_ptr<task_pool> other = o.check && !o.pool ? make_shared<task_pool>(4) : nullptr;
+	bool ok = true;
+	for (int n : o.counts)
+	{
+		result r = run(o, n, o.pool, !o.record.empty());
+		cout << "snakes=" << n
+			<< " threads=" << (o.pool ? o.pool->size() : 1)
+			<< " alive_avg=" << r.alive_avg
+			<< " foods=" << r.foods
+			<< " arena_kb_max=" << r.arena_max / 1024
+			<< " ticks_per_s=" << (r.total_ms > 0 ? 1000 * o.ticks / r.total_ms : 0)
+			<< " tick_avg_ms=" << r.total_ms / o.ticks
+			<< " tick_max_ms=" << r.max_ms
+			<< " " << r.phases
+			<< " hash=" << hex << r.hash << dec;
+		if (o.slow_reader >= 0)
+		{
+			ok = ok && r.reader_ok;
+			cout << " reader_fields=" << r.reader_fields
+				<< " reader_skipped=" << r.reader_skipped
+				<< " reader=" << (r.reader_ok ? "ok" : "FAILED");
+		}
+		if (o.check)
+		{
+			result c = run(o, n, other, false);
+			bool same = c.run_hash == r.run_hash;
+			ok = ok && same;
+			cout << " check=" << (same ? "ok" : "FAILED");
+		}
+		cout << endl;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,45 @@
+#include "columns.hpp"
+#include "game.hpp"
+
+using namespace game_logic;
+
+void snake_columns::build(mem::arena& arena, const snake* snakes, size_t n)
+{
+	layout(arena, snakes, n);
+	fill(snakes, 0, n);
+}
+
+void snake_columns::layout(mem::arena& arena, const snake* snakes, size_t n)
+{
+	offset.alloc(arena, n + 1);
+	w.alloc(arena, n);
+	r.alloc(arena, n);
+	speed.alloc(arena, n);
+	size_t total = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		offset[i] = total;
+		total += snakes[i].skeleton.size();
+		w[i] = snakes[i].w;
+		r[i] = snakes[i].r;
+		speed[i] = snakes[i].speed;
+	}
+	offset[n] = total;
+
+	x.alloc(arena, total);
+	y.alloc(arena, total);
+}
+
+void snake_columns::fill(const snake* snakes, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; ++i)
+	{
+		float *px = x.data() + offset[i], *py = y.data() + offset[i];
+		const point *src = snakes[i].skeleton.data();
+		for (size_t k = 0; k < snakes[i].skeleton.size(); ++k)
+		{
+			px[k] = src[k].x;
+			py[k] = src[k].y;
+		}
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef COLUMNS_HPP
+#define COLUMNS_HPP
+
+#include "alloc.hpp"
+#include "geometry.hpp"
+#include "kernels.hpp"
+#include <algorithm>
+
+namespace game_logic
+{
+	struct snake;
+
+	/* Structure-of-arrays copy of the snakes of a field. Skeleton points of all
+	   snakes are stored back to back, snake s owns [offset[s], offset[s + 1]).
+	   The snakes array stays the primary representation; this one is for passes
+	   that stream over every point. */
+	struct snake_columns
+	{
+		mem::dynarr<float> x, y;
+		mem::dynarr<size_t> offset;
+		mem::dynarr<float> w, r, speed;
+
+		void build(mem::arena& arena, const snake* snakes, size_t n);
+
+		/* build in two steps: layout allocates and fills the per-snake arrays,
+		   then fill copies the points of snakes [begin, end), possibly in parallel */
+		void layout(mem::arena& arena, const snake* snakes, size_t n);
+		void fill(const snake* snakes, size_t begin, size_t end);
+
+		size_t size() const { return w.size(); }
+		size_t points() const { return x.size(); }
+		point at(size_t k) const { return point(x[k], y[k]); }
+
+		/* Calls f(k) for every point k of snake s, counted from its head, closer than sqrt(r2) to c */
+		template<class F>
+		void within(size_t s, point c, float r2, F f) const
+		{
+			const float *px = x.data() + offset[s], *py = y.data() + offset[s];
+			size_t n = offset[s + 1] - offset[s];
+			uint32_t found[256];
+			for (size_t base = 0; base < n; base += 256)
+			{
+				size_t m = kernels().within(px + base, py + base, std::min<size_t>(n - base, 256), c, r2, found);
+				for (size_t k = 0; k < m; ++k)
+				{
+					f(base + found[k]);
+				}
+			}
+		}
+	};
+}
+
+#endif
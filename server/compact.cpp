@@ -0,0 +1,186 @@
+#include "compact.hpp"
+
+#include "snake_generated.h"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+
+using namespace network;
+using namespace std;
+using namespace SnakeGame;
+
+/* Coordinates finer than that are never sent */
+static const float min_step = 1.0f / 1024;
+
+uint16_t network::to_half(float v)
+{
+	uint32_t x;
+	memcpy(&x, &v, sizeof(x));
+	uint16_t sign = (x >> 16) & 0x8000;
+	uint32_t mag = x & 0x7fffffff;
+	if (mag >= 0x7f800000)
+	{
+		/* Infinity, or a quiet NaN */
+		return sign | 0x7c00 | (mag > 0x7f800000 ? 0x200 : 0);
+	}
+	if (mag >= 0x477ff000)
+	{
+		/* 65520 and more round past the largest half */
+		return sign | 0x7c00;
+	}
+	if (mag < 0x38800000)
+	{
+		/* A subnormal half counts 2^-24 units; below 2^-25 everything rounds to zero */
+		if (mag < 0x33000000)
+		{
+			return sign;
+		}
+		uint32_t m = (mag & 0x7fffff) | 0x800000;
+		int shift = 126 - static_cast<int>(mag >> 23);
+		uint32_t h = m >> shift, rest = m & ((1u << shift) - 1), tie = 1u << (shift - 1);
+		if (rest > tie || (rest == tie && (h & 1)))
+		{
+			++h;
+		}
+		return sign | h;
+	}
+	/* Rebias the exponent from 127 to 15 and drop 13 bits of the mantissa; a carry moves into the exponent */
+	uint32_t h = (mag - 0x38000000) >> 13, rest = mag & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+	{
+		++h;
+	}
+	return sign | h;
+}
+
+quantizer::quantizer(game_logic::point _origin, float extent):
+	origin(_origin), step(min_step)
+{
+	if (extent > 0 && extent <= FLT_MAX)
+	{
+		int e;
+		frexp(extent / 32767, &e);
+		step = max(step, ldexp(1.0f, e));
+	}
+}
+
+int16_t quantizer::steps(float d) const
+{
+	float q = round(d / step);
+	if (!(q >= -32767))
+	{
+		return -32767;
+	}
+	return static_cast<int16_t>(min(q, 32767.0f));
+}
+
+namespace
+{
+	/* Grows the box [lo, hi] to p; points that are not finite are left out */
+	void cover(game_logic::point& lo, game_logic::point& hi, game_logic::point p)
+	{
+		if (fabs(p.x) <= FLT_MAX && fabs(p.y) <= FLT_MAX)
+		{
+			lo = game_logic::point(min(lo.x, p.x), min(lo.y, p.y));
+			hi = game_logic::point(max(hi.x, p.x), max(hi.y, p.y));
+		}
+	}
+}
+
+void network::encode_compact(flatbuffers::FlatBufferBuilder& fbb, const game_logic::field& field, const own_snakes& own,
+	const skeleton_lod& lod, bool everything, bool bundle, int input_tick)
+{
+	/* Players get coordinates around their head and every visible point is near one of
+	   the own heads; the whole field is centered on its bounding box */
+	game_logic::point origin = own[0]->skeleton[0];
+	float extent = 0;
+	if (everything)
+	{
+		game_logic::point lo(FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX);
+		for (auto &j : field.snakes)
+		{
+			for (auto &p : j.skeleton)
+			{
+				cover(lo, hi, p);
+			}
+		}
+		for (auto &j : field.foods)
+		{
+			cover(lo, hi, j.p);
+		}
+		if (lo.x <= hi.x)
+		{
+			origin = (lo + hi) * 0.5f;
+			extent = max(hi.x - lo.x, hi.y - lo.y) * 0.5f;
+		}
+	}
+	else
+	{
+		for (auto i : own)
+		{
+			game_logic::point d = i->skeleton[0] - origin;
+			extent = max(extent, max(fabs(d.x), fabs(d.y)) + view_radius(*i));
+		}
+	}
+	quantizer q(origin, extent);
+
+	vector<flatbuffers::Offset<CompactSnake>> snakes;
+	vector<QPoint> skeleton;
+	for (size_t s = 0; s < field.snakes.size(); ++s)
+	{
+		const game_logic::snake &j = field.snakes[s];
+		skeleton.clear();
+		bool first_in = false;
+		auto add = [&](size_t k)
+			{
+				skeleton.emplace_back(q.x(j.skeleton[k].x), q.y(j.skeleton[k].y));
+				first_in = first_in || k == 0;
+			};
+		if (everything)
+		{
+			for (size_t k = 0; k < j.skeleton.size(); ++k)
+			{
+				add(k);
+			}
+		}
+		else
+		{
+			lod_points(field, s, own, lod, add);
+		}
+		if (!skeleton.empty())
+		{
+			snakes.push_back(CreateCompactSnake(fbb, j.p->get_id(), j.id, to_half(j.r),
+				fbb.CreateVectorOfStructs(skeleton), first_in, j.boost));
+		}
+	}
+
+	vector<QFood> foods;
+	auto add_food = [&](const game_logic::food& j)
+		{
+			foods.emplace_back(QPoint(q.x(j.p.x), q.y(j.p.y)), to_half(j.w));
+		};
+	if (everything)
+	{
+		for (auto &j : field.foods)
+		{
+			add_food(j);
+		}
+	}
+	else
+	{
+		visible_foods(field, own, [&](size_t idx) { add_food(field.foods[idx]); });
+	}
+
+	vector<OwnSnake> own_ids;
+	for (size_t k = 0; bundle && k < own.size(); ++k)
+	{
+		own_ids.emplace_back(own[k]->id, own[k]->w);
+	}
+	const game_logic::snake &i = *own[0];
+	Point o(q.origin.x, q.origin.y);
+	auto f = CreateCompactField(fbb, i.id, i.w, field.time, &o, q.step, fbb.CreateVector(snakes),
+		fbb.CreateVectorOfStructs(foods), field.tick, bundle ? fbb.CreateVectorOfStructs(own_ids) : 0, input_tick);
+	auto p = CreatePackage(fbb, PackageType_CompactField, f.Union());
+	FinishPackageBuffer(fbb, p);
+}
@@ -0,0 +1,36 @@
+#ifndef COMPACT_HPP
+#define COMPACT_HPP
+
+#include "game.hpp"
+#include "view.hpp"
+#include <cstdint>
+
+namespace flatbuffers { class FlatBufferBuilder; }
+
+namespace network
+{
+	/* The IEEE 754 half nearest to v, ties to even; values past the range become infinities */
+	uint16_t to_half(float v);
+
+	/* Maps coordinates to int16 steps from an origin. The step is the smallest power
+	   of two that keeps every point within extent of the origin in range. */
+	struct quantizer
+	{
+		quantizer(game_logic::point _origin, float extent);
+		game_logic::point origin;
+		float step;
+		/* Out of range and NaN offsets are clamped */
+		int16_t x(float v) const { return steps(v - origin.x); }
+		int16_t y(float v) const { return steps(v - origin.y); }
+
+		private:
+			int16_t steps(float d) const;
+	};
+
+	/* Finishes a CompactField package with the view of the own snakes, thinned by lod,
+	   or with the whole field when everything is set; bundle lists the own snakes in it */
+	void encode_compact(flatbuffers::FlatBufferBuilder& fbb, const game_logic::field& field, const own_snakes& own,
+		const skeleton_lod& lod, bool everything, bool bundle, int input_tick);
+}
+
+#endif
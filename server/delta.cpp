@@ -0,0 +1,140 @@
+#include "delta.hpp"
+
+#include "snake_generated.h"
+#include <algorithm>
+
+using namespace network;
+using namespace std;
+using namespace SnakeGame;
+
+/* Moves are sent in 1/delta_scale units */
+static const float delta_scale = 32;
+/* A keyframe every that many packages bounds the damage of a client bug */
+static const int keyframe_interval = 64;
+
+void delta_encoder::encode(flatbuffers::FlatBufferBuilder& fbb, const game_logic::field& field, const own_snakes& own, bool bundle, int input_tick)
+{
+	bool keyframe = packages++ % keyframe_interval == 0;
+	if (keyframe)
+	{
+		snakes.clear();
+		foods.clear();
+	}
+	/* Snakes: the visible range of the skeleton, moves where the client has a baseline */
+	map<pair<int, int>, snake_state> next_snakes;
+	vector<flatbuffers::Offset<SnakeDelta>> snake_deltas;
+	vector<int8_t> moves;
+	vector<Point> points;
+	for (size_t s = 0; s < field.snakes.size(); ++s)
+	{
+		const game_logic::snake &j = field.snakes[s];
+		int first = -1, last = -1;
+		visible_points(field, s, own, [&](size_t k)
+			{
+				if (first < 0)
+				{
+					first = k;
+				}
+				last = k + 1;
+			});
+		if (first < 0)
+		{
+			continue;
+		}
+
+		auto key = make_pair(j.p->get_id(), j.id);
+		snake_state &cur = next_snakes[key];
+		cur.first = first;
+		cur.points.assign(j.skeleton.begin() + first, j.skeleton.begin() + last);
+
+		/* Overlap with the baseline */
+		int from = first, to = first;
+		auto base = snakes.find(key);
+		if (base != snakes.end())
+		{
+			from = max(first, base->second.first);
+			to = min(last, base->second.first + static_cast<int>(base->second.points.size()));
+		}
+		bool full = false;
+		moves.clear();
+		for (int k = from; k < to; ++k)
+		{
+			const game_logic::point &prev = base->second.points[k - base->second.first];
+			game_logic::point &p = cur.points[k - first];
+			float dx = round((p.x - prev.x) * delta_scale), dy = round((p.y - prev.y) * delta_scale);
+			if (!(fabs(dx) <= 127 && fabs(dy) <= 127))
+			{
+				full = true;
+				break;
+			}
+			moves.push_back(static_cast<int8_t>(dx));
+			moves.push_back(static_cast<int8_t>(dy));
+			/* Keep exactly what the client reconstructs, so errors never accumulate */
+			p = game_logic::point(prev.x + dx / delta_scale, prev.y + dy / delta_scale);
+		}
+		if (full)
+		{
+			moves.clear();
+			cur.points.assign(j.skeleton.begin() + first, j.skeleton.begin() + last);
+			from = to = first;
+		}
+		points.clear();
+		for (int k = first; k < last; ++k)
+		{
+			if (k < from || k >= to)
+			{
+				points.emplace_back(cur.points[k - first].x, cur.points[k - first].y);
+			}
+		}
+		snake_deltas.push_back(CreateSnakeDelta(fbb, j.p->get_id(), j.id, j.r, j.boost, first, last - first, full,
+			fbb.CreateVector(moves), fbb.CreateVectorOfStructs(points)));
+	}
+	snakes.swap(next_snakes);
+
+	/* Food: visible set difference by id */
+	vector<food_state> visible;
+	visible_foods(field, own, [&](size_t idx)
+		{
+			const game_logic::food &f = field.foods[idx];
+			visible.push_back(food_state{f.id, f.p, f.w});
+		});
+	sort(visible.begin(), visible.end(), [](const food_state& a, const food_state& b) { return a.id < b.id; });
+	vector<FoodItem> added;
+	vector<int> removed;
+	auto old = foods.begin();
+	for (auto &f : visible)
+	{
+		for (; old != foods.end() && old->id < f.id; ++old)
+		{
+			removed.push_back(old->id);
+		}
+		if (old != foods.end() && old->id == f.id)
+		{
+			if (old->p.x != f.p.x || old->p.y != f.p.y || old->w != f.w)
+			{
+				added.emplace_back(f.id, Point(f.p.x, f.p.y), f.w);
+			}
+			++old;
+		}
+		else
+		{
+			added.emplace_back(f.id, Point(f.p.x, f.p.y), f.w);
+		}
+	}
+	for (; old != foods.end(); ++old)
+	{
+		removed.push_back(old->id);
+	}
+	foods.swap(visible);
+
+	vector<OwnSnake> own_ids;
+	for (size_t k = 0; bundle && k < own.size(); ++k)
+	{
+		own_ids.emplace_back(own[k]->id, own[k]->w);
+	}
+	const game_logic::snake &i = *own[0];
+	auto d = CreateFieldDelta(fbb, keyframe, i.id, i.w, field.time, field.tick, fbb.CreateVector(snake_deltas),
+		fbb.CreateVectorOfStructs(added), fbb.CreateVector(removed), bundle ? fbb.CreateVectorOfStructs(own_ids) : 0, input_tick);
+	auto p = CreatePackage(fbb, PackageType_FieldDelta, d.Union());
+	FinishPackageBuffer(fbb, p);
+}
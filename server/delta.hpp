@@ -0,0 +1,43 @@
+#ifndef DELTA_HPP
+#define DELTA_HPP
+
+#include "game.hpp"
+#include "view.hpp"
+#include <map>
+#include <vector>
+#include <utility>
+
+namespace flatbuffers { class FlatBufferBuilder; }
+
+namespace network
+{
+	/* Encodes FieldDelta packages for one connection. The baseline is what the
+	   client has reconstructed from the previous package: TCP delivers every
+	   package in order, so the last one sent is the last one acknowledged. */
+	class delta_encoder
+	{
+		public:
+			/* Finishes a FieldDelta package with the view of the own snakes; bundle lists them in it */
+			void encode(flatbuffers::FlatBufferBuilder& fbb, const game_logic::field& field, const own_snakes& own, bool bundle, int input_tick);
+
+		private:
+			struct snake_state
+			{
+				int first;
+				std::vector<game_logic::point> points;
+			};
+
+			struct food_state
+			{
+				int id;
+				game_logic::point p;
+				float w;
+			};
+
+			std::map<std::pair<int, int>, snake_state> snakes;
+			std::vector<food_state> foods; /* Sorted by id */
+			int packages = 0;
+	};
+}
+
+#endif
@@ -2,43 +2,28 @@
 #include "common.hpp"
 #include <stdexcept>
 #include <iostream>
+#include <limits>
+#include <chrono>
 
 using namespace game_logic;
 using namespace std;
 
-template<int S, int E>
-struct cool_matrix_list
+/* Snakes per chunk of a parallel phase; the chunks must not depend on the number of threads */
+static const size_t grain = 16;
+
+/* Side of the squares in which food is merged into one */
+static const float food_cell_size = 2;
+
+game::food_cell game::food_cell_of(point p)
 {
-	struct elem
-	{
-		int size = 0;
-		int a[E];
-		void push_back(int x)
-		{
-			if (size < E)
-			{
-				a[size++] = x;
-			}
-		}
-		int& operator[](int idx)
-		{
-			return a[idx];
-		}
-		int* begin() { return a; }
-		int* end() { return a + size; }
-	};
-	elem a[2 * S + 1][2 * S + 1];
-	elem zero;
-	enum { Min = -S, Max = S };
-	elem& operator()(int i, int j)
-	{
-		if (i < -S || i > S || j < -S || j > S)
-		{
-			return zero;
-		}
-		return a[i + S][j + S];
-	}
-};
+	/* Adding zero turns -0 into 0, which hashes the same */
+	return food_cell(floor(p.x / food_cell_size) + 0.0f, floor(p.y / food_cell_size) + 0.0f);
+}
+
+size_t game::food_cell_hash::operator()(const food_cell& c) const
+{
+	return hash<float>()(c.first) * 1000003 ^ hash<float>()(c.second);
+}
 
 std::shared_ptr<field> game::get_current_field() const
 {
@@ -48,16 +33,49 @@ std::shared_ptr<field> game::get_current_field() const
 
 void game::set_current_field(const std::shared_ptr<field>& field)
 {
-	lock_guard<mutex> lg(field_mutex);
-	current_field = field;
+	{
+		lock_guard<mutex> lg(field_mutex);
+		current_field = field;
+	}
+	publish(field);
 }
 
-game::directions_t game::get_directions()
+void game::subscribe(const std::weak_ptr<field_subscriber>& s)
+{
+	lock_guard<mutex> lg(subscribers_mutex);
+	subscribers.push_back(s);
+}
+
+void game::publish(const std::shared_ptr<field>& field)
+{
+	/* Subscribers are called unlocked: dropping the last reference to one runs its destructor */
+	vector<shared_ptr<field_subscriber>> live;
+	{
+		lock_guard<mutex> lg(subscribers_mutex);
+		size_t n = 0;
+		for (auto &i : subscribers)
+		{
+			if (auto s = i.lock())
+			{
+				live.push_back(move(s));
+				subscribers[n++] = i;
+			}
+		}
+		subscribers.resize(n);
+	}
+	for (auto &i : live)
+	{
+		i->on_field(field);
+	}
+}
+
+game::directions_t& game::get_directions()
 {
 	lock_guard<mutex> lg(directions_mutex);
-	directions_t ret;
-	swap(ret, directions_queue);
-	return ret;
+	/* Double buffering keeps the capacity of both queues between ticks */
+	directions_work.clear();
+	swap(directions_work, directions_queue);
+	return directions_work;
 }
 
 float game::snake_r(const snake& s) const
@@ -67,15 +85,19 @@ float game::snake_r(const snake& s) const
 
 int game::snake_len(const snake& s) const
 {
-	return cfg.snake_l_k4 * s.w / sqr(s.r) + cfg.snake_l_k5;
+	/* The tick reads the head and the next point, so a light snake keeps two */
+	return max(2, static_cast<int>(cfg.snake_l_k4 * s.w / sqr(s.r) + cfg.snake_l_k5));
 }
 
-vector<snake_request> game::get_create_snakes()
+vector<snake_request>& game::get_create_snakes()
 {
 	lock_guard<mutex> lg(directions_mutex);
-	vector<snake_request> ret;
-	swap(ret, create_snakes_queue);
-	return ret;
+	/* Snakes of the previous tick go first, whenever the others were queued */
+	create_snakes_work.clear();
+	swap(create_snakes_work, create_snakes_next);
+	create_snakes_work.insert(create_snakes_work.end(), create_snakes_queue.begin(), create_snakes_queue.end());
+	create_snakes_queue.clear();
+	return create_snakes_work;
 }
 
 void game::create_snake(const snake_request& r)
@@ -84,16 +106,107 @@ void game::create_snake(const snake_request& r)
 	create_snakes_queue.push_back(r);
 }
 
+/* Only writes cur and its skeleton, which is already allocated */
+void game::move_snake(snake& cur, const snake& prev, const direction& d) const
+{
+	/* Calculate head direction */
+	point prev_direction_vec = prev.skeleton[0] - prev.skeleton[1];
+	point cur_direction_vec = d.p - prev.skeleton[0];
+	if (cur_direction_vec.dist2() < 1e-2)
+	{
+		/* Direction is unknown; keep original direction */
+		cur_direction_vec = prev_direction_vec;
+	}
+	float direction_angle = point::angle(prev_direction_vec, cur_direction_vec);
+	if (fabs(direction_angle) > cfg.max_direction_angle)
+	{
+		if (direction_angle > 0)
+		{
+			cur_direction_vec = prev_direction_vec.rot(cfg.max_direction_angle);
+		}
+		else
+		{
+			cur_direction_vec = prev_direction_vec.rot(-cfg.max_direction_angle);
+		}
+	}
+
+	/* Update speed */
+	if (d.boost)
+	{
+		cur.speed = min(prev.speed + cfg.boost_acceleration_per_tick,
+			cfg.max_speed_multiplier * log(cur.w) + cfg.base_boost_speed);
+		cur.boost = true;
+	}
+	else
+	{
+		cur.speed = max(prev.speed - cfg.boost_acceleration_per_tick,
+			cfg.min_speed_multiplier * log(cur.w) + cfg.base_speed);
+		cur.boost = false;
+	}
+
+	/* Find head position */
+	point cur_head_position = cur_direction_vec.norm() * prev.speed + prev.skeleton[0];
+
+	/* Move the snake */
+	{
+		size_t len = cur.skeleton.size();
+		cur.skeleton[0] = cur_head_position;
+		size_t follow = min(prev.skeleton.size(), len);
+		size_t i;
+		for (i = 1; i < follow; ++i)
+		{
+			point direction = prev.skeleton[i] - cur.skeleton[i - 1]; /* From head towards tail */
+			if (direction.dist2() <= cur.r * cur.r)
+			{
+				/* Once a point stays, the next ones stay while their segment is short enough */
+				size_t run = follow_run(prev.skeleton.data(), i + 1, follow, cur.r * cur.r);
+				copy(prev.skeleton.begin() + i, prev.skeleton.begin() + run, cur.skeleton.begin() + i);
+				i = run - 1;
+			}
+			else
+			{
+				cur.skeleton[i] = cur.skeleton[i - 1] + direction.norm() * cur.r;
+			}
+		}
+		for (; i < len; ++i)
+		{
+			cur.skeleton[i] = cur.skeleton[i - 1];
+		}
+	}
+}
+
 int game::tick()
 {
 	if (!game_started) return -1;
+	auto tick_start = chrono::steady_clock::now(), phase_start = tick_start;
+	auto end_phase = [&](int p)
+		{
+			auto now = chrono::steady_clock::now();
+			metrics.phase_us[p].add(chrono::duration_cast<chrono::microseconds>(now - phase_start).count());
+			phase_start = now;
+		};
 	auto old_field = get_current_field();
-	auto field = make_shared<game_logic::field>(old_field->arena.get_total());
+	auto field = make_shared<game_logic::field>(arenas, old_field->arena.get_total());
 	field->time = old_field->time + cfg.tick_ms / 1000.0f;
 	field->tick = old_field->tick + 1;
 //	dlog(debug) << "tick snakes=" << old_field->snakes.size();
-	auto directions = get_directions();
-	vector<snake_request> create_snakes = get_create_snakes();
+	/* Taken together, so a tick never sees a direction of a player that joins after it */
+	unique_lock<mutex> players_lock(players_mutex);
+	auto &directions = get_directions();
+	auto &create_snakes = get_create_snakes();
+	joins_work.clear();
+	swap(joins_work, joins_queue);
+	players_lock.unlock();
+
+	if (recorder)
+	{
+		input.joins.swap(joins_work);
+		input.directions.clear();
+		for (auto &i : directions)
+		{
+			input.directions.emplace_back(get<0>(i)->get_id(), get<1>(i), get<2>(i));
+		}
+	}
 
 	for (auto& i : directions)
 	{
@@ -102,20 +215,22 @@ int game::tick()
 
 	field->snakes.alloc(field->arena, old_field->snakes.size() + create_snakes.size());
 
-	/* Process snake positions and properties */
-	size_t idx = 0;
+	/* Carry live snakes over; everything with side effects stays on this thread */
+	size_t idx = 0, skeleton_points = 0;
+	mem::dynarr<const snake*> moves_from(field->arena, old_field->snakes.size());
+	mem::dynarr<const direction*> moves_to(field->arena, old_field->snakes.size());
 	for (auto &prev : old_field->snakes)
 	{
 		if (prev.w == 0)
 		{
 			if (--prev.p->snakes == 0)
 			{
-				create_snake(snake_request(prev.p));
+				create_snakes_next.push_back(snake_request(prev.p));
 			}
 			continue;
 		}
 
-		snake &cur = field->snakes[idx++];
+		snake &cur = field->snakes[idx];
 
 		cur.p = prev.p;
 		cur.id = prev.id;
@@ -127,79 +242,44 @@ int game::tick()
 			cur.w = prev.w - cfg.k_10;
 			snake_request s(prev.p);
 			s.w = cfg.k_10;
-			for (ssize_t i = prev.skeleton.size() - 1; i >= 0; --i)
+			/* Consumed by the next tick, while this field is still the current one */
+			s.skeleton.alloc(field->arena, prev.skeleton.size());
+			for (size_t i = 0; i < prev.skeleton.size(); ++i)
 			{
-				s.skeleton.push_back(prev.skeleton[i]);
+				s.skeleton[i] = prev.skeleton[prev.skeleton.size() - 1 - i];
 			}
-			create_snake(s);
+			create_snakes_next.push_back(s);
 		}
 		else
 		{
 			cur.w = prev.w;
 		}
 		cur.r = snake_r(cur);
-		/* Calculate head direction */
-		point prev_direction_vec = prev.skeleton[0] - prev.skeleton[1];
-		point cur_direction_vec = d.p - prev.skeleton[0];
-		if (cur_direction_vec.dist2() < 1e-2)
-		{
-			/* Direction is unknown; keep original direction */
-			cur_direction_vec = prev_direction_vec;
-		}
-		float direction_angle = point::angle(prev_direction_vec, cur_direction_vec);
-		if (fabs(direction_angle) > cfg.max_direction_angle)
-		{
-			if (direction_angle > 0)
-			{
-				cur_direction_vec = prev_direction_vec.rot(cfg.max_direction_angle);
-			}
-			else
-			{
-				cur_direction_vec = prev_direction_vec.rot(-cfg.max_direction_angle);
-			}
-		}
+		skeleton_points += snake_len(cur);
+		moves_from[idx] = &prev;
+		moves_to[idx++] = &d;
+	}
 
-		/* Update speed */
-		if (d.boost)
-		{
-			cur.speed = min(prev.speed + cfg.boost_acceleration_per_tick,
-				cfg.max_speed_multiplier * log(cur.w) + cfg.base_boost_speed);
-			cur.boost = true;
-		}
-		else
+	/* One block for the moved skeletons, so the move phase does not touch the arena */
+	{
+		mem::dynarr<point> block(field->arena, skeleton_points);
+		size_t offset = 0;
+		for (size_t i = 0; i < idx; ++i)
 		{
-			cur.speed = max(prev.speed - cfg.boost_acceleration_per_tick,
-				cfg.min_speed_multiplier * log(cur.w) + cfg.base_speed);
-			cur.boost = false;
+			size_t len = snake_len(field->snakes[i]);
+			field->snakes[i].skeleton = mem::dynarr<point>(block.data() + offset, len);
+			offset += len;
 		}
+	}
 
-		/* Find head position */
-		point cur_head_position = cur_direction_vec.norm() * prev.speed + prev.skeleton[0];
-
-		/* Move the snake */
+	/* Process snake positions and properties */
+	parallel_for(pool.get(), idx, grain, [&](size_t begin, size_t end, size_t)
 		{
-			int len = snake_len(cur);
-			cur.skeleton.alloc(field->arena, len);
-			cur.skeleton[0] = cur_head_position;
-			int i;
-			for (i = 1; i < prev.skeleton.size() && i < len; ++i)
+			for (size_t i = begin; i < end; ++i)
 			{
-				point direction = prev.skeleton[i] - cur.skeleton[i - 1]; /* From head towards tail */
-				if (direction.dist2() <= cur.r * cur.r)
-				{
-					cur.skeleton[i] = prev.skeleton[i];
-				}
-				else
-				{
-					cur.skeleton[i] = cur.skeleton[i - 1] + direction.norm() * cur.r;
-				}
+				move_snake(field->snakes[i], *moves_from[i], *moves_to[i]);
 			}
-			for (; i < len; ++i)
-			{
-				cur.skeleton[i] = cur.skeleton[i - 1];
-			}
-		}
-	}
+		});
 
 	/* Create snakes */
 	for (auto &i : create_snakes)
@@ -212,19 +292,24 @@ int game::tick()
 			cur.w = 100;
 		cur.r = snake_r(cur);
 		cur.speed = cfg.min_speed_multiplier * log(cur.w) + cfg.base_speed;
-		int len = snake_len(cur);
+		size_t len = snake_len(cur);
 		cur.skeleton.alloc(field->arena, len);
-		int k;
-		if (i.skeleton.empty())
+		size_t k;
+		point spawn[2];
+		const point *start = i.skeleton.data();
+		size_t start_len = i.skeleton.size();
+		if (!start_len)
 		{
 			point h(cfg.food_coord_distribution(rng), cfg.food_coord_distribution(rng));
 			float angle = uniform_real_distribution<float>(0, M_PI * 2)(rng);
-			i.skeleton.emplace_back(h);
-			i.skeleton.emplace_back(h + point(0, 1). rot(angle));
+			spawn[0] = h;
+			spawn[1] = h + point(0, 1). rot(angle);
+			start = spawn;
+			start_len = 2;
 		}
-		for (k = 0; k < i.skeleton.size() && k < len; ++k)
+		for (k = 0; k < start_len && k < len; ++k)
 		{
-			cur.skeleton[k] = i.skeleton[k];
+			cur.skeleton[k] = start[k];
 		}
 		for (; k < len; ++k)
 		{
@@ -236,7 +321,7 @@ int game::tick()
 
 	field->snakes.realloc(field->arena, idx);
 
-	vector<food> new_foods;
+	mem::arena_vector<food> new_foods(field->arena, old_field->foods.size() / 8 + 64);
 
 	auto death = [&](snake& s)
 		{
@@ -253,165 +338,316 @@ int game::tick()
 			s.w = 0;
 		};
 
-	/* Process snakes */
-	for (auto &i : field->snakes)
+	end_phase(tick_metrics::move);
+
+	auto &columns = field->columns;
+	columns.layout(field->arena, field->snakes.data(), field->snakes.size());
+
+	/* Index skeletons of the new field; a head can only hit points within its r plus the biggest r */
+	float max_r = 0;
+	for (size_t i = 0; i < columns.size(); ++i)
 	{
-		/* Check snake collisions */
-		point head = i.skeleton[0];
-		for (auto &j : field->snakes)
-		{
-			if (&i == &j || j.w == 0) continue;
-			if ((head - j.skeleton[0]).dist2() <= sqr(i.r + j.r)
-				&& i.speed < j.speed)
+		max_r = max(max_r, columns.r[i]);
+	}
+	grid skeletons;
+	{
+		mem::dynarr<grid::entry> points(field->arena, columns.points());
+		parallel_for(pool.get(), columns.size(), grain, [&](size_t begin, size_t end, size_t)
 			{
-				/* Head collision */
-				death(i);
-				dlog(debug) << "(head collision)";
-				break;
+				columns.fill(field->snakes.data(), begin, end);
+				for (size_t i = begin; i < end; ++i)
+				{
+					for (size_t k = columns.offset[i]; k < columns.offset[i + 1]; ++k)
+					{
+						points[k].p = columns.at(k);
+						points[k].idx = i;
+					}
+				}
+			});
+		skeletons.build(field->arena, points.data(), points.size(), 2 * max_r);
+	}
 
-			}
-			for (auto &k : j.skeleton)
+	end_phase(tick_metrics::index);
+
+	/* Find what every head touches. Nothing dies yet: the hits are resolved below
+	   in snake order, as a snake killed earlier in the pass is not an obstacle */
+	size_t chunks = (field->snakes.size() + grain - 1) / grain;
+	if (hits.size() < chunks)
+	{
+		hits.resize(chunks);
+	}
+	mem::dynarr<int> nan_points(field->arena, field->snakes.size());
+	parallel_for(pool.get(), field->snakes.size(), grain, [&](size_t begin, size_t end, size_t chunk)
+		{
+			auto &found = hits[chunk];
+			found.clear();
+			for (size_t idx = begin; idx < end; ++idx)
 			{
-				if ((head - k).dist2() <= sqr(i.r + j.r))
+				const snake &i = field->snakes[idx];
+				point head = i.skeleton[0];
+				skeletons.query(head, i.r + max_r, [&](const grid::entry& e) -> bool
+					{
+						const snake &j = field->snakes[e.idx];
+						if (e.idx == static_cast<int>(idx) || j.w == 0 || (head - e.p).dist2() > sqr(i.r + j.r))
+						{
+							return false;
+						}
+						if (found.empty() || found.back() != make_pair(static_cast<int>(idx), e.idx))
+						{
+							found.emplace_back(idx, e.idx);
+						}
+						/* Nothing after this snake can be dead yet */
+						return e.idx > static_cast<int>(idx);
+					});
+				nan_points[idx] = 0;
+				for (size_t k = columns.offset[idx]; k < columns.offset[idx + 1]; ++k)
 				{
-					/* Common collision */
-					death(i);
-					break;
+					nan_points[idx] += isnan(columns.x[k]) || isnan(columns.y[k]);
 				}
 			}
-			if (i.w == 0)
+		});
+
+	/* Process snakes */
+	for (size_t chunk = 0; chunk < chunks; ++chunk)
+	{
+		auto hit = hits[chunk].begin();
+		for (size_t idx = chunk * grain; idx < min(field->snakes.size(), (chunk + 1) * grain); ++idx)
+		{
+			snake &i = field->snakes[idx];
+			bool collision = false;
+			for (; hit != hits[chunk].end() && hit->first == static_cast<int>(idx); ++hit)
+			{
+				collision = collision || field->snakes[hit->second].w != 0;
+			}
+			if (collision)
 			{
-				break;
+				death(i);
 			}
-		}
 
-		for (auto &j : i.skeleton)
-		{
-			if (isnan(j.x) || isnan(j.y))
+			for (int k = 0; k < nan_points[idx]; ++k)
 			{
 				dlog(warning) << "nan collision!";
 				death(i);
 			}
-		}
-		
-		/* Calculate scores */
-		i.p->w_sum += i.w;
-		i.p->w_max = max(i.p->w_max, i.w);
 
-		/* Spend boost */
-		if ((field->tick & 7) == 0 && i.boost && i.skeleton.size())
-		{
-			float cur_w = cfg.boost_spend_per_8_ticks * i.w;
-			i.w -= cur_w;
-			new_foods.emplace_back(i.skeleton[i.skeleton.size() - 1], cur_w);
+			/* Calculate scores */
+			i.p->w_sum += i.w;
+			i.p->w_max = max(i.p->w_max, i.w);
+
+			/* Spend boost */
+			if ((field->tick & 7) == 0 && i.boost && i.skeleton.size())
+			{
+				float cur_w = cfg.boost_spend_per_8_ticks * i.w;
+				i.w -= cur_w;
+				new_foods.emplace_back(i.skeleton[i.skeleton.size() - 1], cur_w);
+			}
 		}
 	}
 
+	end_phase(tick_metrics::collide);
+
 	/* FIXME: spread food with boost */
 
 	/* FIXME: borders collision */
 
 	/* Food generation */
-	for (int i = old_field->foods.size(); i < 150; ++i)
+	for (int i = old_field->foods.size(); i < cfg.min_foods; ++i)
 	{
 		new_foods.emplace_back(point(cfg.food_coord_distribution(rng), cfg.food_coord_distribution(rng)), 5);
 	}
 
-	/* Copy food to the new field and feed the snakes */
+	/* Find the eater of every old food: the first live snake whose head reaches it */
+	const int no_eater = numeric_limits<int>::max();
+	mem::dynarr<atomic<int>> eater(field->arena, old_field->foods.size());
+	for (auto &i : eater)
+	{
+		i.store(no_eater, memory_order_relaxed);
+	}
+	parallel_for(pool.get(), field->snakes.size(), grain, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t idx = begin; idx < end; ++idx)
+			{
+				auto &j = field->snakes[idx];
+				if (j.w == 0)
+				{
+					/* The snake is dead; it shouldn't eat itself */
+					continue;
+				}
+				point head = j.skeleton[0];
+				old_field->food_index.query(head, j.r, [&](const grid::entry& e) -> bool
+					{
+						if ((head - e.p).dist2() <= sqr(j.r))
+						{
+							int cur = eater[e.idx].load(memory_order_relaxed);
+							while (static_cast<int>(idx) < cur && !eater[e.idx].compare_exchange_weak(cur, idx, memory_order_relaxed))
+							{
+							}
+						}
+						return false;
+					});
+			}
+		});
+
+	/* Copy food to the new field and feed the snakes in the food order */
 	field->foods.alloc(field->arena, old_field->foods.size() + new_foods.size());
+	mem::dynarr<int> moved(field->arena, old_field->foods.size());
 	int foods_n = 0;
 
 	for (size_t idx = 0; idx < old_field->foods.size(); ++idx)
 	{
 		auto &i = old_field->foods[idx];
+		moved[idx] = -1;
 		if (i.w == 0)
 		{
 			continue;
 		}
-		bool eaten = false;
-		for (auto &j : field->snakes)
+		int e = eater[idx].load(memory_order_relaxed);
+		if (e != no_eater)
 		{
-			if (j.w == 0)
-			{
-				/* The snake is dead; it shouldn't eat itself */
-				continue;
-			}
-
-			if ((j.skeleton[0] - i.p).dist2() <= sqr(j.r))
-			{
-				j.w += i.w;
-				eaten = true;
-				break;
-			}
+			field->snakes[e].w += i.w;
 		}
-		double cur_w = i.w;
-		if (!eaten)
+		else
 		{
-			field->foods[foods_n++] = food(i.p, cur_w);
+			moved[idx] = foods_n;
+			field->foods[foods_n++] = i;
 		}
 	}
-	for (auto &i : new_foods)
-	{
-		field->foods[foods_n++] = i;
-	}
 
-	if ((field->tick & 63) == 0)
+	end_phase(tick_metrics::feed);
+
+	/* Merge every new food into a food in the same merge cell: a surviving one, found
+	   through the index of the old field, or one added earlier in this tick. So a cell
+	   never holds more than one food and only the cells that got food are touched. */
+	food_cells.clear();
+	for (auto &i : new_foods)
 	{
-		cool_matrix_list<200, 5> v;
-		for (size_t idx = 0; idx < foods_n; ++idx)
+		if (i.w == 0)
 		{
-			auto &i = field->foods[idx];
-			v(i.p.x / 2, i.p.y / 2).push_back(idx);
+			continue;
 		}
-		for (int i = v.Min; i <= v.Max; ++i)
+		if (!isfinite(i.p.x) || !isfinite(i.p.y))
 		{
-			for (int j = v.Min; j <= v.Max; ++j)
+			field->foods[foods_n] = i;
+			field->foods[foods_n++].id = -1;
+			continue;
+		}
+		food_cell cell = food_cell_of(i.p);
+		int target = -1;
+		old_field->food_index.query(i.p, 2 * food_cell_size, [&](const grid::entry& e) -> bool
 			{
-				auto &e = v(i, j);
-				for (int k = 1; k < e.size; ++k)
+				if (moved[e.idx] >= 0 && (target < 0 || moved[e.idx] < target) && food_cell_of(e.p) == cell)
 				{
-					field->foods[e[0]].w += field->foods[e[k]].w;
-					field->foods[e[k]].w = 0;
+					target = moved[e.idx];
 				}
-			}
-		}
-		for (size_t idx = 0; idx < foods_n;)
+				return false;
+			});
+		if (target < 0)
 		{
-			if (field->foods[idx].w == 0)
-			{
-				--foods_n;
-				std::swap(field->foods[foods_n], field->foods[idx]);
-			}
-			else
+			auto it = food_cells.find(cell);
+			if (it != food_cells.end())
 			{
-				++idx;
+				target = it->second;
 			}
 		}
+		if (target >= 0)
+		{
+			field->foods[target].w += i.w;
+			/* A new id, so delta clients learn the new weight */
+			field->foods[target].id = -1;
+		}
+		else
+		{
+			food_cells.emplace(cell, foods_n);
+			field->foods[foods_n] = i;
+			field->foods[foods_n++].id = -1;
+		}
+	}
+	for (int idx = 0; idx < foods_n; ++idx)
+	{
+		if (field->foods[idx].id < 0)
+		{
+			field->foods[idx].id = food_id_seq++;
+		}
 	}
 	
 	field->foods.realloc(field->arena, foods_n);
 
+	for (size_t idx = 0; idx < field->snakes.size(); ++idx)
+	{
+		columns.w[idx] = field->snakes[idx].w;
+	}
+
+	/* Index the food for the next tick and for visibility queries */
+	{
+		mem::dynarr<grid::entry> points(field->arena, foods_n);
+		for (int i = 0; i < foods_n; ++i)
+		{
+			points[i].p = field->foods[i].p;
+			points[i].idx = i;
+		}
+		field->food_index.build(field->arena, points.data(), foods_n, 2 * max_r);
+	}
+
+	end_phase(tick_metrics::food);
+	metrics.tick_us.add(chrono::duration_cast<chrono::microseconds>(phase_start - tick_start).count());
+	metrics.arena_bytes = field->arena.get_total();
+	metrics.snakes = field->snakes.size();
+	metrics.foods = field->foods.size();
+
 	set_current_field(field);
+	if (recorder)
+	{
+		recorder->on_tick(input, field);
+	}
 
 	return field->tick;
 }
 
 food::food(point _p, float _w):
-	p(_p), w(_w)
+	p(_p), w(_w), id(-1)
+{
+}
+
+field::field(const std::shared_ptr<mem::arena_pool>& pool, size_t arena_size):
+	arena(pool, arena_size)
 {
 }
 
-field::field(size_t arena_size):
-	arena(arena_size)
+uint64_t field::hash() const
 {
+	fnv f;
+	f.add(tick);
+	for (auto &i : snakes)
+	{
+		f.add(i.p->get_id());
+		f.add(i.id);
+		f.add(i.w);
+		f.add(i.r);
+		f.add(i.speed);
+		f.add(i.boost);
+		for (auto &j : i.skeleton)
+		{
+			f.add(j.x);
+			f.add(j.y);
+		}
+	}
+	for (auto &i : foods)
+	{
+		f.add(i.p.x);
+		f.add(i.p.y);
+		f.add(i.w);
+	}
+	return f.h;
 }
 
 std::shared_ptr<player> game::get_player(const string& login, int level)
 {
+	lock_guard<mutex> lg(players_mutex);
 	auto it = players.find(login);
 	if (it == players.end())
 	{
 		it = players.emplace(login, make_shared<player>(player_id_seq++, level)).first;
+		joins_queue.emplace_back(login, level);
 		dlog(info) << "GAME " << login << " " << it->second->get_id();
 		if (game_started && level == 1)
 		{
@@ -438,6 +674,27 @@ const configuration& game::get_configuration() const
 	return cfg;
 }
 
+void game::set_task_pool(const std::shared_ptr<task_pool>& _pool)
+{
+	pool = _pool;
+}
+
+void game::set_recorder(const std::shared_ptr<tick_recorder>& _recorder)
+{
+	recorder = _recorder;
+}
+
+const tick_metrics& game::get_metrics() const
+{
+	return metrics;
+}
+
+const char* tick_metrics::phase_name(int p)
+{
+	static const char *names[phases] = { "move", "index", "collide", "feed", "food" };
+	return names[p];
+}
+
 void game::set_direction(player *p, int snake_id, const direction& d)
 {
 	lock_guard<mutex> l(directions_mutex);
@@ -447,6 +704,7 @@ void game::set_direction(player *p, int snake_id, const direction& d)
 player::player(int _id, int _level):
 	id(_id),
 	snake_id_seq(0),
+	connections(0),
 	level(_level)
 {
 }
@@ -462,11 +720,38 @@ int player::get_next_snake_id()
 }
 
 game::game(const configuration& _cfg):
-	current_field(make_shared<field>(16384)),
+	game_started(false),
+	arenas(make_shared<mem::arena_pool>()),
+	current_field(make_shared<field>(arenas, 16384)),
 	cfg(_cfg),
 	player_id_seq(0),
-	game_started(false)
+	food_id_seq(0),
+	rng(_cfg.seed)
 {
 	current_field->time = 0;
 	current_field->tick = 0;
 }
+
+configuration game_logic::default_configuration()
+{
+	configuration cfg;
+	cfg.boost_acceleration_per_tick = 0.1;
+	cfg.boost_spend_per_8_ticks = 0.01;
+	cfg.max_direction_angle = 3.14 / 8;
+	cfg.default_w = 20;
+	cfg.snake_r_k1 = 1.0 / log(20);
+	cfg.snake_r_k2 = 1;
+	cfg.snake_r_k3 = 10;
+	cfg.snake_l_k4 = 0.5;
+	cfg.snake_l_k5 = 0;
+	cfg.k_10 = 1000;
+	cfg.max_speed_multiplier = 0.3;
+	cfg.min_speed_multiplier = 0.2;
+	cfg.base_speed = 0.6;
+	cfg.base_boost_speed = 1.3;
+	cfg.food_coord_distribution = std::normal_distribution<float>(0, 100);
+	cfg.tick_ms = 75;
+	cfg.min_foods = 150;
+	cfg.seed = std::mt19937_64::default_seed;
+	return cfg;
+}
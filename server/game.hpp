@@ -2,52 +2,29 @@
 #define GAME_HPP
 
 #include "alloc.hpp"
+#include "geometry.hpp"
+#include "grid.hpp"
+#include "columns.hpp"
+#include "pool.hpp"
+#include "stats.hpp"
 #include <memory>
 #include <vector>
 #include <mutex>
+#include <atomic>
 #include <tuple>
 #include <cmath>
 #include <map>
+#include <unordered_map>
 #include <string>
 #include <set>
 #include <random>
 #include <sstream>
+#include <cstdint>
 
 namespace network { class connection; }
 
 namespace game_logic
 {
-	struct point
-	{
-		float x, y;
-
-		explicit point(float _x = 0, float _y = 0): x(_x), y(_y) {}
-
-		point operator+(const point& other) const { return point(x + other.x, y + other.y); }
-		point operator-(const point& other) const { return point(x - other.x, y - other.y); }
-		point operator*(float k) const { return point(x * k, y * k); }
-		point operator/(float k) const { return point(x / k, y / k); }
-		float dist2() const { return x * x + y * y; }
-		float dist() const { return sqrt(dist2()); }
-		point norm() const { return *this / dist(); }
-		point rot(float angle) const
-		{
-			return point(x * cos(angle) - y * sin(angle), x * sin(angle) + y * cos(angle));
-		}
-		
-		static float sprod(const point& a, const point& b) { return a.x * b.x + a.y * b.y; }
-		static float vprod(const point& a, const point& b) { return a.x * b.y - a.y * b.x; }
-		static float angle(const point& a, const point& b) { return atan2(vprod(a, b), sprod(a, b)); }
-	};
-
-	inline static std::ostream& operator<<(std::ostream& s, point p)
-	{
-		s << "(" << p.x << "," << p.y << ")";
-		return s;
-	}
-	
-	inline static float sqr(float x) { return x * x; }
-
 	class player;
 
 	struct snake
@@ -66,16 +43,44 @@ namespace game_logic
 		food(point _p = point(), float _w = 0);
 		point p;
 		float w;
+		/* Stable identity for delta updates, assigned when the food enters a field */
+		int id;
+	};
+
+	/* FNV-1a over the bytes of the values added */
+	struct fnv
+	{
+		uint64_t h = 14695981039346656037ULL;
+		template<class T> void add(const T& v)
+		{
+			const unsigned char *p = reinterpret_cast<const unsigned char*>(&v);
+			for (size_t i = 0; i < sizeof(T); ++i)
+			{
+				h = (h ^ p[i]) * 1099511628211ULL;
+			}
+		}
 	};
 
 	struct field
 	{
-		field(size_t arena_size);
+		field(const std::shared_ptr<mem::arena_pool>& pool, size_t arena_size);
 		mem::arena arena;
 		float time;
 		int tick;
 		mem::dynarr<snake> snakes;
 		mem::dynarr<food> foods;
+		/* The snakes as columns; geometry is fixed after movement, w is synced at the end of the tick */
+		snake_columns columns;
+		/* Food positions, built once per tick */
+		grid food_index;
+		/* Full-visibility Field package for spectators, serialized by network on first request */
+		std::once_flag spectator_once;
+		std::shared_ptr<const std::vector<char>> spectator_package;
+		/* The same as a CompactField package */
+		std::once_flag spectator_compact_once;
+		std::shared_ptr<const std::vector<char>> spectator_compact_package;
+		/* FNV-1a over the whole state; equal for bit-identical fields */
+		uint64_t hash() const;
 	};
 
 	struct direction
@@ -94,7 +99,7 @@ namespace game_logic
 			player(int _id, int _level = 1);
 			int get_id() const;
 			int get_next_snake_id();
-			int connections = 0;
+			std::atomic<int> connections;
 			std::map<int, direction> directions;
 			int snakes = 0;
 			float w_sum = 0;
@@ -113,14 +118,58 @@ namespace game_logic
 		float max_speed_multiplier, min_speed_multiplier, base_speed, base_boost_speed;
 		std::normal_distribution<float> food_coord_distribution, food_w_distribution;
 		int tick_ms;
+		/* Food generation tops the field up to this count */
+		int min_foods;
+		/* Seed of the game rng; equal seeds and inputs give bit-identical fields */
+		uint64_t seed;
 	};
 
+	configuration default_configuration();
+
 	struct snake_request
 	{
 		snake_request(player* _p): p(_p), w(0) {}
 		player* p;
 		float w;
-		std::vector<point> skeleton;
+		/* Allocated in a field arena; empty for a new snake at a random place */
+		mem::dynarr<point> skeleton;
+	};
+
+	/* Filled by every tick, read by the metrics endpoint; never reset */
+	struct tick_metrics
+	{
+		enum phase { move, index, collide, feed, food, phases };
+		static const char* phase_name(int p);
+
+		latency_histogram phase_us[phases];
+		latency_histogram tick_us;
+		std::atomic<uint64_t> arena_bytes{0}, snakes{0}, foods{0};
+	};
+
+	/* Gets every new field right after the tick that made it. on_field runs on the
+	   tick thread, so it must only hand the field over and return. */
+	class field_subscriber
+	{
+		public:
+			virtual void on_field(const std::shared_ptr<field>& f) = 0;
+			virtual ~field_subscriber() {}
+	};
+
+	/* What a tick took from outside the game, in the order it was given */
+	struct tick_input
+	{
+		/* Arguments of get_player calls that made a new player */
+		std::vector<std::pair<std::string, int>> joins;
+		/* Player id, snake id and direction of every set_direction call */
+		std::vector<std::tuple<int, int, direction>> directions;
+	};
+
+	/* Gets the inputs and the result of every tick on the tick thread; must not block */
+	class tick_recorder
+	{
+		public:
+			virtual void on_tick(const tick_input& in, const std::shared_ptr<field>& f) = 0;
+			virtual ~tick_recorder() {}
 	};
 
 	class game
@@ -133,28 +182,64 @@ namespace game_logic
 			void create_snake(const snake_request& r);
 			std::shared_ptr<player> get_player(const std::string& login, int level = 1);
 			const configuration& get_configuration() const;
-			bool game_started;
+			/* Runs the parallel phases of tick(); without a pool they run on the ticking thread */
+			void set_task_pool(const std::shared_ptr<task_pool>& _pool);
+			/* Set before the first tick; a game replayed with the same inputs makes the same fields */
+			void set_recorder(const std::shared_ptr<tick_recorder>& _recorder);
+			const tick_metrics& get_metrics() const;
+			/* Subscribers are dropped when they expire */
+			void subscribe(const std::weak_ptr<field_subscriber>& s);
+			std::atomic<bool> game_started;
 
 		private:
 			std::map<std::string, std::shared_ptr<player>> players;
+			/* Connections log in from their own strands */
+			std::mutex players_mutex;
+			std::vector<std::pair<std::string, int>> joins_queue, joins_work;
 
+			/* Arenas of retired fields are reused by the next ones */
+			std::shared_ptr<mem::arena_pool> arenas;
 			std::shared_ptr<field> current_field;
 			mutable std::mutex field_mutex;
 			void set_current_field(const std::shared_ptr<field>& field);
+			std::vector<std::weak_ptr<field_subscriber>> subscribers;
+			std::mutex subscribers_mutex;
+			void publish(const std::shared_ptr<field>& field);
 
 			typedef std::vector<std::tuple<player*, int, direction>> directions_t;
-			directions_t directions_queue;
+			directions_t directions_queue, directions_work;
 			mutable std::mutex directions_mutex;
-			directions_t get_directions();
-			std::vector<snake_request> create_snakes_queue;
-			std::vector<snake_request> get_create_snakes();
+			directions_t& get_directions();
+			std::vector<snake_request> create_snakes_queue, create_snakes_work;
+			/* Made by a tick for the next one; only the ticking thread touches them */
+			std::vector<snake_request> create_snakes_next;
+			std::vector<snake_request>& get_create_snakes();
 
 			configuration cfg;
 
+			std::shared_ptr<task_pool> pool;
+			tick_metrics metrics;
+			std::shared_ptr<tick_recorder> recorder;
+			tick_input input;
+			/* Collisions found by each chunk of snakes, as (snake, obstacle) pairs; kept between ticks */
+			std::vector<std::vector<std::pair<int, int>>> hits;
+
+			/* A square of the field; all new food landing in one is merged into a single food */
+			typedef std::pair<float, float> food_cell;
+			struct food_cell_hash
+			{
+				size_t operator()(const food_cell& c) const;
+			};
+			static food_cell food_cell_of(point p);
+			/* Cells that got a new food in this tick; kept between ticks */
+			std::unordered_map<food_cell, int, food_cell_hash> food_cells;
+
 			int player_id_seq;
+			int food_id_seq;
 
 			float snake_r(const snake& s) const;
 			int snake_len(const snake& s) const;
+			void move_snake(snake& cur, const snake& prev, const direction& d) const;
 
 			std::mt19937_64 rng;
 	};
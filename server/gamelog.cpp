@@ -0,0 +1,183 @@
+#include "gamelog.hpp"
+#include "game.hpp"
+#include "common.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+
+using namespace game_logic;
+using namespace std;
+
+/* How long the writer sleeps between batches */
+static const chrono::milliseconds write_interval(200);
+
+game_log::game_log(const string& _path, uint64_t _max_bytes, int _keep):
+	path(_path), max_bytes(_max_bytes), keep(max(1, _keep)), ring(new entry[ring_size]),
+	head(0), tail(0), dropped(0), stop(false)
+{
+	thread = std::thread([this]() { run(); });
+}
+
+game_log::~game_log()
+{
+	stop = true;
+	thread.join();
+	if (file)
+	{
+		fclose(file);
+	}
+}
+
+void game_log::add(const field& f)
+{
+	size_t h = head.load(memory_order_relaxed);
+	size_t n = f.snakes.size() + 1;
+	if (ring_size - (h - tail.load(memory_order_acquire)) < n)
+	{
+		dropped.fetch_add(1, memory_order_relaxed);
+		return;
+	}
+	entry &e = ring[h++ & (ring_size - 1)];
+	e.tick = f.tick;
+	e.player = -1;
+	e.w = f.time;
+	for (auto &i : f.snakes)
+	{
+		entry &s = ring[h++ & (ring_size - 1)];
+		s.tick = f.tick;
+		s.player = i.p->get_id();
+		s.w = i.w;
+	}
+	head.store(h, memory_order_release);
+}
+
+uint64_t game_log::get_dropped() const
+{
+	return dropped.load(memory_order_relaxed);
+}
+
+void game_log::run()
+{
+	for (;;)
+	{
+		/* Whatever the tick thread added before stop is still written */
+		bool last = stop;
+		if (drain())
+		{
+			write();
+		}
+		if (last)
+		{
+			return;
+		}
+		this_thread::sleep_for(write_interval);
+	}
+}
+
+bool game_log::drain()
+{
+	size_t t = tail.load(memory_order_relaxed);
+	size_t h = head.load(memory_order_acquire);
+	if (t == h)
+	{
+		return false;
+	}
+	/* The tick thread publishes whole fields, so h is always at a head entry */
+	while (t != h)
+	{
+		size_t to = t + 1;
+		for (; to != h && ring[to & (ring_size - 1)].player >= 0; ++to)
+		{
+		}
+		format(t, to);
+		t = to;
+	}
+	tail.store(h, memory_order_release);
+	return true;
+}
+
+void game_log::format(size_t from, size_t to)
+{
+	const entry &e = ring[from & (ring_size - 1)];
+	players.clear();
+	for (size_t i = from + 1; i != to; ++i)
+	{
+		const entry &s = ring[i & (ring_size - 1)];
+		players.emplace_back(s.player, s.w);
+	}
+	sort(players.begin(), players.end());
+
+	char buf[64];
+	snprintf(buf, sizeof(buf), "{\"tick\":%d,\"time\":%g,\"w\":{", e.tick, e.w);
+	out += buf;
+	for (size_t i = 0; i < players.size();)
+	{
+		int player = players[i].first;
+		float w = 0;
+		for (; i < players.size() && players[i].first == player; ++i)
+		{
+			w += players[i].second;
+		}
+		snprintf(buf, sizeof(buf), "%s\"%d\":%g", out.back() == '{' ? "" : ",", player, w);
+		out += buf;
+	}
+	out += "}}\n";
+}
+
+void game_log::write()
+{
+	if (!file)
+	{
+		open();
+	}
+	if (file)
+	{
+		if (fwrite(out.data(), 1, out.size(), file) != out.size() || fflush(file))
+		{
+			dlog(warning) << "Cannot write game log " << path << ": " << strerror(errno);
+			fclose(file);
+			file = nullptr;
+		}
+		else
+		{
+			file_bytes += out.size();
+		}
+	}
+	out.clear();
+	if (file && max_bytes && file_bytes >= max_bytes)
+	{
+		rotate();
+	}
+}
+
+void game_log::open()
+{
+	file = fopen(path.c_str(), "a");
+	if (!file)
+	{
+		if (!open_failed)
+		{
+			dlog(warning) << "Cannot open game log " << path << ": " << strerror(errno);
+		}
+		open_failed = true;
+		return;
+	}
+	open_failed = false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	file_bytes = size > 0 ? size : 0;
+}
+
+void game_log::rotate()
+{
+	fclose(file);
+	file = nullptr;
+	remove((path + "." + to_string(keep)).c_str());
+	for (int i = keep - 1; i >= 1; --i)
+	{
+		rename((path + "." + to_string(i)).c_str(), (path + "." + to_string(i + 1)).c_str());
+	}
+	rename(path.c_str(), (path + ".1").c_str());
+	open();
+}
@@ -0,0 +1,75 @@
+#ifndef GAMELOG_HPP
+#define GAMELOG_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace game_logic
+{
+	struct field;
+
+	/* Weights of all players, one NDJSON line per logged tick:
+	   {"tick":N,"time":T,"w":{"player":weight,...}}
+	   The tick thread only copies the snakes into a lock-free ring; a writer thread
+	   formats and writes them in batches. When the file grows past max_bytes it is
+	   renamed to path.1, path.1 to path.2 and so on, keeping keep old files. */
+	class game_log
+	{
+		public:
+			game_log(const std::string& _path, uint64_t _max_bytes, int _keep);
+			~game_log();
+			game_log(const game_log&) = delete;
+			game_log& operator=(const game_log&) = delete;
+
+			/* Tick thread only. Never blocks: a field that does not fit into the ring is dropped */
+			void add(const field& f);
+			/* Fields dropped because the writer was behind */
+			uint64_t get_dropped() const;
+
+			static const size_t ring_size = 1 << 16;
+
+		private:
+			/* A field is a head with player -1, the time in w and the tick,
+			   followed by one entry per snake */
+			struct entry
+			{
+				int32_t tick;
+				int32_t player;
+				float w;
+			};
+
+			std::string path;
+			uint64_t max_bytes;
+			int keep;
+
+			std::unique_ptr<entry[]> ring;
+			/* head is written by the tick thread only, tail by the writer only */
+			std::atomic<size_t> head, tail;
+			std::atomic<uint64_t> dropped;
+			std::atomic<bool> stop;
+			std::thread thread;
+
+			/* Writer thread only */
+			FILE *file = nullptr;
+			uint64_t file_bytes = 0;
+			/* Warned about a file that cannot be opened; it is tried again with every batch */
+			bool open_failed = false;
+			std::string out;
+			std::vector<std::pair<int, float>> players;
+
+			void run();
+			/* Formats everything in the ring; false when it was empty */
+			bool drain();
+			void format(size_t from, size_t to);
+			void write();
+			void open();
+			void rotate();
+	};
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef GEOMETRY_HPP
+#define GEOMETRY_HPP
+
+#include <cmath>
+#include <ostream>
+
+namespace game_logic
+{
+	struct point
+	{
+		float x, y;
+
+		explicit point(float _x = 0, float _y = 0): x(_x), y(_y) {}
+
+		point operator+(const point& other) const { return point(x + other.x, y + other.y); }
+		point operator-(const point& other) const { return point(x - other.x, y - other.y); }
+		point operator*(float k) const { return point(x * k, y * k); }
+		point operator/(float k) const { return point(x / k, y / k); }
+		float dist2() const { return x * x + y * y; }
+		float dist() const { return sqrt(dist2()); }
+		point norm() const { return *this / dist(); }
+		point rot(float angle) const
+		{
+			return point(x * cos(angle) - y * sin(angle), x * sin(angle) + y * cos(angle));
+		}
+		
+		static float sprod(const point& a, const point& b) { return a.x * b.x + a.y * b.y; }
+		static float vprod(const point& a, const point& b) { return a.x * b.y - a.y * b.x; }
+		static float angle(const point& a, const point& b) { return atan2(vprod(a, b), sprod(a, b)); }
+	};
+
+	inline static std::ostream& operator<<(std::ostream& s, point p)
+	{
+		s << "(" << p.x << "," << p.y << ")";
+		return s;
+	}
+	
+	inline static float sqr(float x) { return x * x; }
+}
+
+#endif
@@ -0,0 +1,86 @@
+#include "grid.hpp"
+#include <algorithm>
+#include <limits>
+
+using namespace game_logic;
+using namespace std;
+
+grid::grid():
+	x0(0), y0(0), cell(1), inv_cell(1), w(0), h(0)
+{
+}
+
+void grid::build(mem::arena& arena, const entry* src, size_t n, float cell_size)
+{
+	float x1 = 0, y1 = 0;
+	size_t valid = 0;
+	x0 = y0 = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		const point &p = src[i].p;
+		if (!isfinite(p.x) || !isfinite(p.y))
+		{
+			continue;
+		}
+		if (valid++ == 0)
+		{
+			x0 = x1 = p.x;
+			y0 = y1 = p.y;
+		}
+		else
+		{
+			x0 = min(x0, p.x); x1 = max(x1, p.x);
+			y0 = min(y0, p.y); y1 = max(y1, p.y);
+		}
+	}
+
+	/* Keep the number of cells proportional to the number of points */
+	cell = cell_size > 0 ? cell_size : 1;
+	double max_cells = 4.0 * valid + 64;
+	double cw = floor((x1 - x0) / cell) + 1, ch = floor((y1 - y0) / cell) + 1;
+	if (!(cw * ch <= 1e18))
+	{
+		/* Extent overflows a float: everything goes to one cell */
+		cell = numeric_limits<float>::infinity();
+		cw = ch = 1;
+	}
+	else if (cw * ch > max_cells)
+	{
+		cell *= sqrt(cw * ch / max_cells);
+		cw = floor((x1 - x0) / cell) + 1;
+		ch = floor((y1 - y0) / cell) + 1;
+	}
+	inv_cell = 1 / cell;
+	w = static_cast<int>(cw);
+	h = static_cast<int>(ch);
+
+	cells.alloc(arena, w * h + 1);
+	fill(cells.begin(), cells.end(), 0);
+	int *cell_of = arena.alloc_array<int>(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		const point &p = src[i].p;
+		if (!isfinite(p.x) || !isfinite(p.y))
+		{
+			cell_of[i] = -1;
+			continue;
+		}
+		cell_of[i] = cell_y(p.y) * w + cell_x(p.x);
+		++cells[cell_of[i] + 1];
+	}
+	for (int i = 0; i < w * h; ++i)
+	{
+		cells[i + 1] += cells[i];
+	}
+
+	/* Stable placement keeps the source order inside every cell */
+	entries.alloc(arena, valid);
+	int *pos = arena.alloc_array_copy(cells.data(), w * h);
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (cell_of[i] >= 0)
+		{
+			entries[pos[cell_of[i]]++] = src[i];
+		}
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef GRID_HPP
+#define GRID_HPP
+
+#include "alloc.hpp"
+#include "geometry.hpp"
+
+namespace game_logic
+{
+	/* Uniform grid over a set of points, rebuilt from scratch every tick.
+	   Entries are counting-sorted by cell and cells are stored row by row,
+	   so any horizontal run of cells is one contiguous slice of entries. */
+	class grid
+	{
+		public:
+			struct entry
+			{
+				point p;
+				int idx;
+			};
+
+			grid();
+
+			/* Non-finite points are dropped: they never pass a distance test anyway */
+			void build(mem::arena& arena, const entry* src, size_t n, float cell_size);
+
+			/* Calls f for every entry that may lie within r of c; f returns true to stop.
+			   Returns true if stopped. Callers still do the exact distance test. */
+			template<class F>
+			bool query(point c, float r, F f) const
+			{
+				if (!w || !std::isfinite(c.x) || !std::isfinite(c.y) || !(r >= 0))
+				{
+					return false;
+				}
+				r += cell / 1024;
+				int cx0 = cell_x(c.x - r), cx1 = cell_x(c.x + r);
+				int cy0 = cell_y(c.y - r), cy1 = cell_y(c.y + r);
+				for (int cy = cy0; cy <= cy1; ++cy)
+				{
+					const entry *b = entries.data() + cells[cy * w + cx0], *e = entries.data() + cells[cy * w + cx1 + 1];
+					for (; b != e; ++b)
+					{
+						if (f(*b))
+						{
+							return true;
+						}
+					}
+				}
+				return false;
+			}
+
+			size_t size() const { return entries.size(); }
+			const entry* begin() const { return entries.begin(); }
+			const entry* end() const { return entries.end(); }
+
+		private:
+			float x0, y0, cell, inv_cell;
+			int w, h;
+			mem::dynarr<int> cells;
+			mem::dynarr<entry> entries;
+
+			static int clamp_cell(float c, int n)
+			{
+				if (!(c >= 0)) return 0;
+				if (c >= n) return n - 1;
+				return static_cast<int>(c);
+			}
+			int cell_x(float x) const { return clamp_cell((x - x0) * inv_cell, w); }
+			int cell_y(float y) const { return clamp_cell((y - y0) * inv_cell, h); }
+	};
+}
+
+#endif
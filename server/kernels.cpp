@@ -0,0 +1,120 @@
+#include "kernels.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+using namespace game_logic;
+using namespace std;
+
+namespace
+{
+	size_t within_scalar(const float *x, const float *y, size_t n, point c, float r2, uint32_t *out)
+	{
+		size_t m = 0;
+		for (size_t k = 0; k < n; ++k)
+		{
+			float dx = x[k] - c.x, dy = y[k] - c.y;
+			if (dx * dx + dy * dy < r2)
+			{
+				out[m++] = k;
+			}
+		}
+		return m;
+	}
+
+	const kernel_set scalar_set = { "scalar", within_scalar };
+
+#ifdef KERNELS_X86
+	__attribute__((target("sse2")))
+	size_t within_sse(const float *x, const float *y, size_t n, point c, float r2, uint32_t *out)
+	{
+		__m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), vr2 = _mm_set1_ps(r2);
+		size_t m = 0, k = 0;
+		for (; k + 4 <= n; k += 4)
+		{
+			__m128 dx = _mm_sub_ps(_mm_loadu_ps(x + k), cx), dy = _mm_sub_ps(_mm_loadu_ps(y + k), cy);
+			__m128 d = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+			for (int mask = _mm_movemask_ps(_mm_cmplt_ps(d, vr2)); mask; mask &= mask - 1)
+			{
+				out[m++] = k + __builtin_ctz(mask);
+			}
+		}
+		for (; k < n; ++k)
+		{
+			float dx = x[k] - c.x, dy = y[k] - c.y;
+			if (dx * dx + dy * dy < r2)
+			{
+				out[m++] = k;
+			}
+		}
+		return m;
+	}
+
+	const kernel_set sse_set = { "sse2", within_sse };
+
+	__attribute__((target("avx2")))
+	size_t within_avx2(const float *x, const float *y, size_t n, point c, float r2, uint32_t *out)
+	{
+		__m256 cx = _mm256_set1_ps(c.x), cy = _mm256_set1_ps(c.y), vr2 = _mm256_set1_ps(r2);
+		size_t m = 0, k = 0;
+		for (; k + 8 <= n; k += 8)
+		{
+			__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + k), cx), dy = _mm256_sub_ps(_mm256_loadu_ps(y + k), cy);
+			__m256 d = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+			for (int mask = _mm256_movemask_ps(_mm256_cmp_ps(d, vr2, _CMP_LT_OQ)); mask; mask &= mask - 1)
+			{
+				out[m++] = k + __builtin_ctz(mask);
+			}
+		}
+		for (; k < n; ++k)
+		{
+			float dx = x[k] - c.x, dy = y[k] - c.y;
+			if (dx * dx + dy * dy < r2)
+			{
+				out[m++] = k;
+			}
+		}
+		return m;
+	}
+
+	const kernel_set avx2_set = { "avx2", within_avx2 };
+#endif
+}
+
+/* A NaN segment is not short either: the caller recomputes that point */
+size_t game_logic::follow_run(const point *p, size_t from, size_t n, float r2)
+{
+	for (size_t i = from; i < n; ++i)
+	{
+		if (!((p[i] - p[i - 1]).dist2() <= r2))
+		{
+			return i;
+		}
+	}
+	return n;
+}
+
+vector<const kernel_set*> game_logic::supported_kernels()
+{
+	vector<const kernel_set*> ret{&scalar_set};
+#ifdef KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+	{
+		ret.push_back(&sse_set);
+		if (__builtin_cpu_supports("avx2"))
+		{
+			ret.push_back(&avx2_set);
+		}
+	}
+#endif
+	return ret;
+}
+
+const kernel_set& game_logic::kernels()
+{
+	static const kernel_set &best = *supported_kernels().back();
+	return best;
+}
@@ -0,0 +1,33 @@
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+#include "geometry.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace game_logic
+{
+	/* Returns the first i in [from, n) with (p[i] - p[i - 1]).dist2() > r2, or n; from must be positive.
+	   Scalar only: each step depends on the previous one and runs are short, so vectors did not pay off. */
+	size_t follow_run(const point *p, size_t from, size_t n, float r2);
+
+	/* Batched float kernels with a scalar fallback and SSE/AVX2 versions picked at run time.
+	   Every version does the same operations in the same order without FMA, so the
+	   results are bit-identical and the choice never changes the game state. */
+	struct kernel_set
+	{
+		const char *name;
+
+		/* Writes every k < n with (x[k] - c.x)^2 + (y[k] - c.y)^2 < r2 to out, in order; returns their number */
+		size_t (*within)(const float *x, const float *y, size_t n, point c, float r2, uint32_t *out);
+	};
+
+	/* The scalar set first, the best one last */
+	std::vector<const kernel_set*> supported_kernels();
+
+	/* The best set supported by this CPU, chosen on first use */
+	const kernel_set& kernels();
+}
+
+#endif
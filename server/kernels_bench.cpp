@@ -0,0 +1,77 @@
+#include "kernels.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+using namespace game_logic;
+using namespace std;
+
+/* Skeleton of n points spaced around r, like a moving snake with a bunched tail */
+static vector<point> make_skeleton(mt19937& rng, size_t n, float r)
+{
+	uniform_real_distribution<float> angle(0, 2 * M_PI), step(0.5f * r, 1.2f * r);
+	vector<point> ret(n);
+	for (size_t i = 1; i < n; ++i)
+	{
+		float a = angle(rng);
+		ret[i] = i > n * 3 / 4 ? ret[i - 1] : ret[i - 1] + point(cos(a), sin(a)) * step(rng);
+	}
+	return ret;
+}
+
+template<class F>
+static double time_ns(size_t reps, F f)
+{
+	auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < reps; ++i)
+	{
+		f();
+	}
+	return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / reps;
+}
+
+int main(int ac, char** av)
+{
+	size_t reps = ac > 1 ? atoi(av[1]) : 20000;
+	auto sets = supported_kernels();
+	/* Skeleton lengths of light, average and heavy snakes, and all points of a crowded field */
+	for (size_t n : {5, 94, 530, 20000})
+	{
+		mt19937 rng(n);
+		float r = 2;
+		vector<point> skeleton = make_skeleton(rng, n, r);
+		vector<float> x(n), y(n);
+		for (size_t i = 0; i < n; ++i)
+		{
+			x[i] = skeleton[i].x;
+			y[i] = skeleton[i].y;
+		}
+		point c = skeleton[n / 2];
+		float r2 = sqr(25 * r);
+		vector<uint32_t> out(n);
+		size_t expect_within = sets[0]->within(x.data(), y.data(), n, c, r2, out.data());
+		size_t runs = 0;
+		double follow_ns = time_ns(reps, [&]()
+			{
+				runs = 0;
+				for (size_t i = 1; i < n; i = follow_run(skeleton.data(), i, n, r * r) + 1)
+				{
+					runs += i;
+				}
+			});
+		cout << "n=" << n << " follow_run_ns=" << follow_ns << endl;
+		for (auto s : sets)
+		{
+			size_t found = 0;
+			double within_ns = time_ns(reps, [&]()
+				{
+					found = s->within(x.data(), y.data(), n, c, r2, out.data());
+				});
+			cout << "n=" << n << " kernels=" << s->name
+				<< " within_ns=" << within_ns
+				<< (found == expect_within ? "" : " MISMATCH") << endl;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef MAILBOX_HPP
+#define MAILBOX_HPP
+
+#include "game.hpp"
+#include <memory>
+#include <mutex>
+
+namespace network
+{
+	/* Holds the newest field a consumer has not taken yet. A consumer that is still
+	   busy with an older field never falls behind: a newer field replaces the one
+	   waiting, and the skipped ticks show in the tick numbers it takes. */
+	class field_mailbox
+	{
+		public:
+			/* Returns true when the mailbox was empty, so the consumer has to be woken */
+			bool put(const std::shared_ptr<game_logic::field>& f)
+			{
+				std::lock_guard<std::mutex> lg(m);
+				bool idle = !latest;
+				latest = f;
+				return idle;
+			}
+
+			/* The waiting field, or null */
+			std::shared_ptr<game_logic::field> take()
+			{
+				std::lock_guard<std::mutex> lg(m);
+				return std::move(latest);
+			}
+
+		private:
+			std::mutex m;
+			std::shared_ptr<game_logic::field> latest;
+	};
+}
+
+#endif
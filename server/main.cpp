@@ -1,66 +1,179 @@
 #include "network.hpp"
 #include "game.hpp"
 #include "userdb.hpp"
+#include "ticker.hpp"
+#include "metrics.hpp"
+#include "replay.hpp"
+#include "gamelog.hpp"
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <functional>
 #include <cmath>
 #include "common.hpp"
-#include <fstream>
+#include <thread>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include <sys/stat.h>
 
 int main(int ac, char** av)
 {
+	/* Threads running the io_service; every connection is serialized by its own strand */
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	/* Fields 0 .. fields - 1, each ticked on its own thread */
+	int fields = 1;
+	/* Threads sharing the parallel phases of all ticks; 1 ticks every field serially */
+	int tick_threads = std::max(1u, std::thread::hardware_concurrency());
+	/* Local HTTP port of the metrics endpoint; 0 turns it off */
+	int metrics_port = 2001;
+	/* Field n is seeded with seed + n, so a recorded field can be replayed; unset seeds all alike */
+	bool seeded = false;
+	uint64_t seed = 0;
+	/* Every field n is recorded to record/field.n; empty records nothing */
+	std::string record;
+	/* Skeleton points farther than that many radii of the receiving snake are thinned; 0 sends all */
+	float lod_distance = 30;
+	/* The game log of a field is rotated when it grows past log_max_bytes, keeping log_keep old files */
+	uint64_t log_max_bytes = 64 << 20;
+	int log_keep = 4;
+	for (int i = 1; i + 1 < ac; i += 2)
+	{
+		if (std::string(av[i]) == "--threads")
+		{
+			threads = std::max(1, atoi(av[i + 1]));
+		}
+		else if (std::string(av[i]) == "--fields")
+		{
+			fields = std::max(1, atoi(av[i + 1]));
+		}
+		else if (std::string(av[i]) == "--tick-threads")
+		{
+			tick_threads = std::max(1, atoi(av[i + 1]));
+		}
+		else if (std::string(av[i]) == "--metrics-port")
+		{
+			metrics_port = std::max(0, atoi(av[i + 1]));
+		}
+		else if (std::string(av[i]) == "--seed")
+		{
+			seeded = true;
+			seed = strtoull(av[i + 1], nullptr, 0);
+		}
+		else if (std::string(av[i]) == "--record")
+		{
+			record = av[i + 1];
+		}
+		else if (std::string(av[i]) == "--lod-distance")
+		{
+			lod_distance = std::max(0.0, atof(av[i + 1]));
+		}
+		else if (std::string(av[i]) == "--log-max-bytes")
+		{
+			log_max_bytes = strtoull(av[i + 1], nullptr, 0);
+		}
+		else if (std::string(av[i]) == "--log-keep")
+		{
+			log_keep = std::max(1, atoi(av[i + 1]));
+		}
+	}
+
 	boost::asio::io_service ios;
 	auto server = std::make_shared<network::server>(ios, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), 2000));
-	game_logic::configuration cfg;
-
-	cfg.boost_acceleration_per_tick = 0.1;
-	cfg.boost_spend_per_8_ticks = 0.01;
-	cfg.max_direction_angle = 3.14 / 8;
-	cfg.default_w = 20;
-	cfg.snake_r_k1 = 1.0 / log(20);
-	cfg.snake_r_k2 = 1;
-	cfg.snake_r_k3 = 10;
-	cfg.snake_l_k4 = 0.5;
-	cfg.snake_l_k5 = 0;
-	cfg.k_10 = 1000;
-	cfg.max_speed_multiplier = 0.3;
-	cfg.min_speed_multiplier = 0.2;
-	cfg.base_speed = 0.6;
-	cfg.base_boost_speed = 1.3;
-	cfg.food_coord_distribution = std::normal_distribution<float>(0, 100);
-	cfg.tick_ms = 75;
+	game_logic::configuration cfg = game_logic::default_configuration();
 	auto users = std::make_shared<userdb::user_db>("users.txt");
-	std::ofstream gameLog("gameLog.json");
-		auto f0 = std::make_shared<game_logic::game>(cfg);
-		f0->game_started = true;
-		server->add_game(0, f0);
-		server->set_users(users);
-	
-		periodic_timer *tick_timer = new periodic_timer(ios, boost::posix_time::milliseconds(75));
-		tick_timer->set_cb([f0, &gameLog]()
+	server->set_users(users);
+	server->lod.distance = lod_distance;
+
+	std::shared_ptr<network::metrics_server> metrics;
+	if (metrics_port)
+	{
+		metrics = std::make_shared<network::metrics_server>(ios,
+			boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), metrics_port));
+		metrics->add_source([server](std::ostream& os) { server->write_metrics(os); });
+	}
+
+	std::shared_ptr<game_logic::task_pool> tick_pool;
+	if (tick_threads > 1)
+	{
+		tick_pool = std::make_shared<game_logic::task_pool>(tick_threads);
+	}
+
+	if (!record.empty())
+	{
+		mkdir(record.c_str(), 0755);
+	}
+
+	std::vector<std::unique_ptr<game_logic::game_log>> logs;
+	std::vector<std::unique_ptr<game_logic::ticker>> tickers;
+	for (int n = 0; n < fields; ++n)
+	{
+		if (seeded)
+		{
+			cfg.seed = seed + n;
+		}
+		auto g = std::make_shared<game_logic::game>(cfg);
+		g->set_task_pool(tick_pool);
+		g->game_started = true;
+		if (!record.empty())
+		{
+			g->set_recorder(std::make_shared<replay::writer>(record + "/field." + std::to_string(n), cfg, true));
+		}
+		server->add_game(n, g);
+
+		logs.emplace_back(new game_logic::game_log(n ? "gameLog." + std::to_string(n) + ".ndjson" : "gameLog.ndjson",
+			log_max_bytes, log_keep));
+		game_logic::game_log *log = logs.back().get();
+		tickers.emplace_back(new game_logic::ticker(n, g, std::chrono::milliseconds(cfg.tick_ms)));
+		tickers.back()->set_cb([g, log](int t)
 			{
-				int t = f0->tick();
 				if ((t & 15) == 0)
 				{
-					dlog(debug) << "1";
-					gameLog << "{" << "\n";
-					auto f = f0->get_current_field();
-					std::map<int, float> ws;
-					for (auto &i : f->snakes)
-					{
-						ws[i.p->get_id()] += i.w;
-					}
-					bool first = true;
-					for (auto &i : ws)
-					{
-						gameLog << "\t" << (first ? "" : ",") << "\"" << i.first << "\": " << i.second  << "\n";
-						first = false;
-					}
-					gameLog << "}," << std::endl;
-					gameLog.flush();
+					log->add(*g->get_current_field());
 				}
 			});
-		tick_timer->start_many();
+		tickers.back()->start();
+
+		if (metrics)
+		{
+			game_logic::ticker *t = tickers.back().get();
+			metrics->add_source([n, g, t, log](std::ostream& os)
+				{
+					std::string field = "field=\"" + std::to_string(n) + "\"";
+					auto &m = g->get_metrics();
+					for (int p = 0; p < game_logic::tick_metrics::phases; ++p)
+					{
+						network::write_histogram(os, "slither_tick_phase_us",
+							field + ",phase=\"" + game_logic::tick_metrics::phase_name(p) + "\"", m.phase_us[p]);
+					}
+					network::write_histogram(os, "slither_tick_us", field, m.tick_us);
+					network::write_metric(os, "slither_arena_bytes", field, m.arena_bytes);
+					network::write_metric(os, "slither_snakes", field, m.snakes);
+					network::write_metric(os, "slither_foods", field, m.foods);
+					network::write_metric(os, "slither_game_log_dropped", field, log->get_dropped());
+					/* The ticker restarts these with every jitter report */
+					network::write_metric(os, "slither_tick_lateness_p99_us", field, t->get_lateness().percentile(0.99));
+					network::write_metric(os, "slither_tick_lateness_max_us", field, t->get_lateness().max());
+					network::write_metric(os, "slither_tick_duration_p99_us", field, t->get_duration().percentile(0.99));
+					network::write_metric(os, "slither_tick_duration_max_us", field, t->get_duration().max());
+				});
+		}
+	}
+
+	if (metrics)
+	{
+		metrics->start();
+	}
+
+	dlog(info) << "Running on " << threads << " threads, ticking on " << tick_threads;
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; ++i)
+	{
+		pool.emplace_back([&ios]() { ios.run(); });
+	}
 	ios.run();
+	for (auto &i : pool)
+	{
+		i.join();
+	}
 	return 0;
 }
@@ -0,0 +1,122 @@
+#include "metrics.hpp"
+#include "common.hpp"
+#include <sstream>
+
+using namespace network;
+using namespace std;
+
+#define MAX_REQUEST_LEN 4096
+
+namespace
+{
+	struct http_session : public enable_shared_from_this<http_session>
+	{
+		boost::asio::ip::tcp::socket sock;
+		boost::asio::streambuf request;
+		string response;
+
+		http_session(boost::asio::ip::tcp::socket _sock):
+			sock(move(_sock)), request(MAX_REQUEST_LEN)
+		{
+		}
+
+		void start(const string& body)
+		{
+			response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+				+ to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+			auto self = shared_from_this();
+			/* The request itself does not matter; wait for its end so the client reads the answer */
+			boost::asio::async_read_until(sock, request, "\r\n\r\n", [this, self](boost::system::error_code ec, size_t)
+				{
+					if (ec)
+					{
+						return;
+					}
+					boost::asio::async_write(sock, boost::asio::buffer(response), [this, self](boost::system::error_code, size_t)
+						{
+							boost::system::error_code ignored;
+							sock.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+						});
+				});
+		}
+	};
+}
+
+metrics_server::metrics_server(boost::asio::io_service& _ios, const boost::asio::ip::tcp::endpoint& _endpoint):
+	acceptor(_ios, _endpoint),
+	socket(_ios)
+{
+	dlog(info) << "Metrics on " << _endpoint;
+}
+
+void metrics_server::add_source(const source_t& source)
+{
+	sources.push_back(source);
+}
+
+void metrics_server::start()
+{
+	do_accept();
+}
+
+void metrics_server::do_accept()
+{
+	auto self = shared_from_this();
+	acceptor.async_accept(socket, [this, self](boost::system::error_code ec)
+		{
+			if (!ec)
+			{
+				make_shared<http_session>(move(socket))->start(render());
+			}
+			else
+			{
+				dlog(warning) << "Metrics accept failed: " << ec.message();
+			}
+			do_accept();
+		});
+}
+
+string metrics_server::render() const
+{
+	ostringstream os;
+	for (auto &i : sources)
+	{
+		i(os);
+	}
+	return os.str();
+}
+
+void network::write_metric(ostream& os, const string& name, const string& labels, double value)
+{
+	os << name;
+	if (!labels.empty())
+	{
+		os << "{" << labels << "}";
+	}
+	/* Enough digits to keep every counter below 2^53 exact */
+	streamsize precision = os.precision(17);
+	os << " " << value << "\n";
+	os.precision(precision);
+}
+
+void network::write_histogram(ostream& os, const string& name, const string& labels, const latency_histogram& h)
+{
+	string prefix = labels.empty() ? "" : labels + ",";
+	uint64_t seen = 0;
+	int last = latency_histogram::buckets - 1;
+	while (last > 0 && !h.bucket(last))
+	{
+		--last;
+	}
+	for (int b = 0; b <= last; ++b)
+	{
+		seen += h.bucket(b);
+		/* Values are integers, so the bucket below 2^b ends at 2^b - 1 */
+		os << name << "_bucket{" << prefix << "le=\"" << latency_histogram::bucket_limit(b) - 1 << "\"} " << seen << "\n";
+	}
+	/* Adds may run concurrently; the buckets are what the scraper checks for consistency */
+	os << name << "_bucket{" << prefix << "le=\"+Inf\"} " << seen << "\n";
+	write_metric(os, name + "_sum", labels, h.sum());
+	write_metric(os, name + "_count", labels, seen);
+	write_metric(os, name + "_max", labels, h.max());
+}
@@ -0,0 +1,40 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include "stats.hpp"
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace network
+{
+	/* Answers every HTTP request with all metrics in the Prometheus text format.
+	   Meant for local scraping: one request per connection, no keep-alive. */
+	class metrics_server : public std::enable_shared_from_this<metrics_server>
+	{
+		public:
+			typedef std::function<void(std::ostream&)> source_t;
+
+			metrics_server(boost::asio::io_service& _ios, const boost::asio::ip::tcp::endpoint& _endpoint);
+			/* Sources are added before the io_service runs */
+			void add_source(const source_t& source);
+			void start();
+
+		private:
+			boost::asio::ip::tcp::acceptor acceptor;
+			boost::asio::ip::tcp::socket socket;
+			std::vector<source_t> sources;
+
+			void do_accept();
+			std::string render() const;
+	};
+
+	void write_metric(std::ostream& os, const std::string& name, const std::string& labels, double value);
+	/* Cumulative buckets, _sum and _count, plus name_max as a gauge */
+	void write_histogram(std::ostream& os, const std::string& name, const std::string& labels, const latency_histogram& h);
+}
+
+#endif
@@ -2,6 +2,12 @@
 #include "common.hpp"
 #include "game.hpp"
 #include "userdb.hpp"
+#include "delta.hpp"
+#include "compact.hpp"
+#include "view.hpp"
+#include "metrics.hpp"
+#include <chrono>
+#include <sstream>
 
 #include "snake_generated.h"
 
@@ -11,6 +17,10 @@ using namespace SnakeGame;
 
 #define MAX_LEN 16384
 #define MAX_CONNECTIONS 5
+/* Fields wait in the mailbox, so a connection that queues that much is not reading at all */
+#define MAX_QUEUED_BYTES (4 << 20)
+/* Packages gathered into one write */
+#define MAX_WRITE_PACKAGES 64
 
 server::server(boost::asio::io_service& _ios, const boost::asio::ip::tcp::endpoint& _endpoint):
 	acceptor(_ios, _endpoint),
@@ -37,32 +47,50 @@ void server::do_accept()
 }
 
 connection::connection(const shared_ptr<server>& _srv, boost::asio::ip::tcp::socket _sock):
-	srv(_srv), sock(move(_sock)), timer(sock.get_io_service(), boost::posix_time::milliseconds(100)),
+	srv(_srv), sock(move(_sock)), strand(sock.get_io_service()),
 	pkg_queue(0)
 {
+	sent_ticks.fill(make_pair(-1, chrono::steady_clock::time_point()));
 	dlog(info) << "Created connection " << this;
 }
 
 void connection::start()
 {
 	dlog(info) << "Starting connection " << this;
+	srv->add_connection(shared_from_this());
 	do_read_header();
-	std::weak_ptr<connection> wp(shared_from_this());
-	timer.set_cb([wp]()
-		{
-			auto sp = wp.lock();
-			if (sp && sp->game)
-			{
-				sp->send_field(sp->game->get_current_field());
-			}
-		});
+}
+
+void connection::on_field(const shared_ptr<game_logic::field>& f)
+{
+	/* Only the latest field is kept; skipped ticks show up in frames_dropped */
+	if (mailbox.put(f))
+	{
+		auto self = shared_from_this();
+		strand.post([this, self]() { deliver(); });
+	}
+}
+
+void connection::deliver()
+{
+	/* While the previous field is being written the new one waits in the
+	   mailbox; the write completion delivers it */
+	if (pkg_queue)
+	{
+		return;
+	}
+	auto f = mailbox.take();
+	if (f)
+	{
+		send_field(f);
+	}
 }
 
 void connection::do_read_header()
 {
 	auto self = shared_from_this();
 	boost::asio::async_read(sock, boost::asio::buffer(current_length_buf, sizeof(current_length_buf)),
-		[this, self](boost::system::error_code ec, size_t)
+		strand.wrap([this, self](boost::system::error_code ec, size_t)
 		{
 			if (!ec)
 			{
@@ -85,14 +113,14 @@ void connection::do_read_header()
 			{
 				dlog(warning) << " Read failed: " << ec.message();
 			}
-		});
+		}));
 }
 
 void connection::do_read_body()
 {
 	auto self = shared_from_this();
 	boost::asio::async_read(sock, boost::asio::buffer(current_body_read_buf),
-		[this, self](boost::system::error_code ec, size_t)
+		strand.wrap([this, self](boost::system::error_code ec, size_t)
 		{
 			if (!ec)
 			{
@@ -102,7 +130,7 @@ void connection::do_read_body()
 			{
 				dlog(warning) << this << " Read failed: " << ec.message();
 			}
-		});
+		}));
 }
 
 void connection::error(const string& text)
@@ -116,28 +144,90 @@ void connection::error(const string& text)
 	send_package(fbb);
 }
 
-void connection::send_package(const flatbuffers::FlatBufferBuilder& fbb)
+package_buffer network::make_package_buffer(const flatbuffers::FlatBufferBuilder& fbb)
 {
-	++pkg_queue;
+	auto buf = make_shared<vector<char>>(sizeof(int32_t) + fbb.GetSize());
 	int32_t pkg_size = htonl(fbb.GetSize());
-	current_write_buf.resize(sizeof(pkg_size) + fbb.GetSize());
-	memcpy(current_write_buf.data(), &pkg_size, sizeof(pkg_size));
-	memcpy(current_write_buf.data() + sizeof(pkg_size), fbb.GetBufferPointer(), fbb.GetSize());
+	memcpy(buf->data(), &pkg_size, sizeof(pkg_size));
+	memcpy(buf->data() + sizeof(pkg_size), fbb.GetBufferPointer(), fbb.GetSize());
+	return buf;
+}
+
+void connection::send_package(const flatbuffers::FlatBufferBuilder& fbb)
+{
+	send_package(make_package_buffer(fbb));
+}
+
+void connection::send_package(const package_buffer& buf)
+{
+	if (write_failed)
+	{
+		return;
+	}
+	out_queue.push_back(buf);
+	queued_bytes += buf->size();
+	srv->queue_depth.add(++pkg_queue);
+	srv->package_bytes.add(buf->size());
+	if (queued_bytes > MAX_QUEUED_BYTES)
+	{
+		dlog(warning) << "Connection " << this << ": " << queued_bytes << " bytes queued. Dropping connection.";
+		close_writes();
+		boost::system::error_code ignored;
+		sock.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+		return;
+	}
+	do_write();
+}
+
+void connection::do_write()
+{
+	if (!writing.empty() || out_queue.empty())
+	{
+		return;
+	}
+	vector<boost::asio::const_buffer> bufs;
+	while (!out_queue.empty() && writing.size() < MAX_WRITE_PACKAGES)
+	{
+		writing.push_back(move(out_queue.front()));
+		out_queue.pop_front();
+		bufs.push_back(boost::asio::buffer(*writing.back()));
+	}
 	auto self = shared_from_this();
-	boost::asio::async_write(sock, boost::asio::buffer(current_write_buf), [this, self](boost::system::error_code ec, size_t)
+	/* The buffers are kept alive by writing until the write completes */
+	boost::asio::async_write(sock, bufs, strand.wrap([this, self](boost::system::error_code ec, size_t len)
 		{
 			if (ec)
 			{
 				dlog(info) << "Connection " << this << ": write error: " << ec.message() << ". Dropping connection.";
+				close_writes();
+				return;
+			}
+			bytes_sent.fetch_add(len, memory_order_relaxed);
+			packages_sent.fetch_add(writing.size(), memory_order_relaxed);
+			pkg_queue -= writing.size();
+			queued_bytes -= len;
+			writing.clear();
+			if (out_queue.empty())
+			{
+				deliver();
 			}
 			else
 			{
-				if (!--pkg_queue)
-				{
-					timer.start_once();
-				}
+				do_write();
 			}
-		});
+		}));
+}
+
+void connection::close_writes()
+{
+	write_failed = true;
+	out_queue.clear();
+	pkg_queue = writing.size();
+	queued_bytes = 0;
+	for (auto &i : writing)
+	{
+		queued_bytes += i->size();
+	}
 }
 
 void connection::handle_body()
@@ -196,16 +286,19 @@ void connection::handle_login(const Login* pkg)
 	}
 
 	player = game->get_player(login, level_);
-	if (!player || player->connections > MAX_CONNECTIONS)
+	/* Other logins of the player run on their own strands, so take the slot before checking it */
+	if (player && player->connections.fetch_add(1) >= MAX_CONNECTIONS)
+	{
+		--player->connections;
+		player = nullptr;
+	}
+	if (!player)
 	{
 		error("Cannot register the player for the game");
 		game = nullptr;
-		player = nullptr;
 		return;
 	}
 
-	++player->connections; 
-
 	dlog(info) << this 
 		<< " logged in login=" << login 
 		<< " level=" << level_
@@ -213,8 +306,18 @@ void connection::handle_login(const Login* pkg)
 		<< " player=" << player.get();
 	
 	level = level_;
+	player_id = player->get_id();
+	if (pkg->delta() && level < 10)
+	{
+		/* Spectators keep the shared full snapshot */
+		delta = true;
+	}
+	bundle = pkg->bundle() && level < 10;
+	/* Deltas already send moves in a few bits */
+	compact = pkg->compact() && !delta;
 
 	do_send_welcome();
+	game->subscribe(shared_from_this());
 }
 
 void connection::handle_direction(const Direction* pkg)
@@ -231,6 +334,20 @@ void connection::handle_direction(const Direction* pkg)
 	d.boost = pkg->boost();
 	d.split = pkg->split();
 	game->set_direction(player.get(), pkg->snake_id(), d);
+
+	if (pkg->tick() >= 0)
+	{
+		input_tick = pkg->tick();
+		/* Timed once per Field: a bundle answers with a direction for every snake */
+		auto &sent = sent_ticks[pkg->tick() % sent_ticks.size()];
+		if (sent.first == pkg->tick())
+		{
+			auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - sent.second).count();
+			srv->input_latency_us.add(us);
+			input_latency_us = us;
+			sent.first = -1;
+		}
+	}
 }
 
 std::shared_ptr<userdb::user_db> server::get_users() const
@@ -247,7 +364,7 @@ std::shared_ptr<game_logic::game> server::get_game(int field) const
 void connection::do_send_welcome()
 {
 	flatbuffers::FlatBufferBuilder fbb;
-	auto w = CreateWelcome(fbb, player->get_id(), game->get_configuration().k_10);
+	auto w = CreateWelcome(fbb, player->get_id(), game->get_configuration().k_10, game->get_configuration().tick_ms);
 	auto p = CreatePackage(fbb, PackageType_Welcome, w.Union());
 	FinishPackageBuffer(fbb, p);
 	send_package(fbb);
@@ -255,6 +372,7 @@ void connection::do_send_welcome()
 
 connection::~connection()
 {
+	srv->remove_connection(this);
 	if (player)
 	{
 		--player->connections;
@@ -276,34 +394,35 @@ void server::set_users(const std::shared_ptr<userdb::user_db>& _users)
 	users = _users;
 }
 
-void connection::send_field(const std::shared_ptr<game_logic::field>& field)
+namespace
 {
-	if (!player) return;
-	/* Find the snakes of this player */
-	for (auto &i : field->snakes)
+	/* Builds the Field package as seen by the own snakes, thinned by lod; spectators see everything */
+	package_buffer make_field_package(const game_logic::field& field, const own_snakes& own, const skeleton_lod& lod,
+		bool everything, bool bundle, int input_tick)
 	{
 		flatbuffers::FlatBufferBuilder fbb;
 		std::vector<flatbuffers::Offset<Snake>> snakes;
-		if (i.p != player.get() && level < 10)
-		{
-			continue;
-		}
 		/* Find nearby snakes */
-		for (auto &j : field->snakes)
+		for (size_t s = 0; s < field.snakes.size(); ++s)
 		{
+			const game_logic::snake &j = field.snakes[s];
 			std::vector<Point> skeleton;
-			bool first = true, first_in = false;
-			for (auto &k : j.skeleton)
+			bool first_in = false;
+			auto add = [&](size_t k)
+				{
+					skeleton.emplace_back(j.skeleton[k].x, j.skeleton[k].y);
+					first_in = first_in || k == 0;
+				};
+			if (everything)
 			{
-				if (level >= 10 || (k - i.skeleton[0]).dist2() < game_logic::sqr(100 * i.r))
+				for (size_t k = 0; k < j.skeleton.size(); ++k)
 				{
-					skeleton.emplace_back(k.x, k.y);
-					if (first)
-					{
-						first_in = true;
-					}
+					add(k);
 				}
-				first = false;
+			}
+			else
+			{
+				lod_points(field, s, own, lod, add);
 			}
 			if (!skeleton.empty())
 			{
@@ -315,24 +434,190 @@ void connection::send_field(const std::shared_ptr<game_logic::field>& field)
 
 		/* Find nearby foods */
 		std::vector<Food> foods;
-		for (auto &j : field->foods)
+		if (everything)
 		{
-			if (level >= 10 || (j.p - i.skeleton[0]).dist2() < game_logic::sqr(100*i.r))
+			for (auto &j : field.foods)
 			{
 				foods.emplace_back(Food(Point(j.p.x, j.p.y), j.w));
 			}
 		}
-		auto f = CreateField(fbb, i.id, i.w, field->time, fbb.CreateVector(snakes), fbb.CreateVectorOfStructs(foods));
+		else
+		{
+			visible_foods(field, own, [&](size_t idx)
+				{
+					const game_logic::food &j = field.foods[idx];
+					foods.emplace_back(Food(Point(j.p.x, j.p.y), j.w));
+				});
+		}
+		std::vector<OwnSnake> own_ids;
+		for (size_t k = 0; bundle && k < own.size(); ++k)
+		{
+			own_ids.emplace_back(own[k]->id, own[k]->w);
+		}
+		const game_logic::snake &i = *own[0];
+		auto f = CreateField(fbb, i.id, i.w, field.time, fbb.CreateVector(snakes), fbb.CreateVectorOfStructs(foods), 0, field.tick,
+			bundle ? fbb.CreateVectorOfStructs(own_ids) : 0, input_tick);
 		auto p = CreatePackage(fbb, PackageType_Field, f.Union());
 		FinishPackageBuffer(fbb, p);
-		send_package(fbb);
-		if (level >= 10)
+		return make_package_buffer(fbb);
+	}
+
+	/* All spectators of a field share one snapshot, serialized on first request */
+	package_buffer spectator_package(game_logic::field& field)
+	{
+		std::call_once(field.spectator_once, [&field]()
+			{
+				field.spectator_package = make_field_package(field, own_snakes{&field.snakes[0]}, skeleton_lod(), true, false, -1);
+			});
+		return field.spectator_package;
+	}
+
+	package_buffer spectator_compact_package(game_logic::field& field)
+	{
+		std::call_once(field.spectator_compact_once, [&field]()
+			{
+				flatbuffers::FlatBufferBuilder fbb;
+				encode_compact(fbb, field, own_snakes{&field.snakes[0]}, skeleton_lod(), true, false, -1);
+				field.spectator_compact_package = make_package_buffer(fbb);
+			});
+		return field.spectator_compact_package;
+	}
+}
+
+void connection::send_field(const std::shared_ptr<game_logic::field>& field)
+{
+	if (!player) return;
+	if (last_tick >= 0 && field->tick > last_tick + 1)
+	{
+		int skipped = field->tick - last_tick - 1;
+		frames_dropped.fetch_add(skipped, memory_order_relaxed);
+		srv->dropped_frames.add(skipped);
+	}
+	last_tick = field->tick;
+	auto start = chrono::steady_clock::now();
+	if (level >= 10)
+	{
+		if (field->snakes.size())
+		{
+			send_package(compact ? spectator_compact_package(*field) : spectator_package(*field));
+		}
+	}
+	else
+	{
+		/* Find the snakes of this player; a bundle gets one package for all of them */
+		own_snakes own;
+		for (auto &i : field->snakes)
+		{
+			if (i.p == player.get())
+			{
+				own.push_back(&i);
+			}
+		}
+		auto send_view = [&](const own_snakes& view)
+			{
+				if (delta)
+				{
+					/* Each snake's view is a different viewport, so each has a baseline of its own */
+					auto &encoder = encoders[view[0]->id];
+					if (!encoder)
+					{
+						encoder.reset(new delta_encoder);
+					}
+					flatbuffers::FlatBufferBuilder fbb;
+					encoder->encode(fbb, *field, view, bundle, input_tick);
+					send_package(make_package_buffer(fbb));
+				}
+				else if (compact)
+				{
+					flatbuffers::FlatBufferBuilder fbb;
+					encode_compact(fbb, *field, view, srv->lod, false, bundle, input_tick);
+					send_package(make_package_buffer(fbb));
+				}
+				else
+				{
+					send_package(make_field_package(*field, view, srv->lod, false, bundle, input_tick));
+				}
+			};
+		if (bundle && !own.empty())
+		{
+			send_view(own);
+		}
+		else
+		{
+			for (auto i : own)
+			{
+				send_view(own_snakes{i});
+			}
+		}
+		/* Snake ids are never reused, so baselines no package was made with go */
+		size_t viewers = bundle ? min<size_t>(own.size(), 1) : own.size();
+		for (auto i = encoders.begin(); i != encoders.end();)
+		{
+			bool used = false;
+			for (size_t k = 0; k < viewers && !used; ++k)
+			{
+				used = own[k]->id == i->first;
+			}
+			i = used ? next(i) : encoders.erase(i);
+		}
+	}
+	auto end = chrono::steady_clock::now();
+	srv->serialize_us.add(chrono::duration_cast<chrono::microseconds>(end - start).count());
+	sent_ticks[field->tick % sent_ticks.size()] = make_pair(field->tick, end);
+}
+
+int connection::get_queue_depth() const
+{
+	return pkg_queue;
+}
+
+size_t connection::get_queued_bytes() const
+{
+	return queued_bytes;
+}
+
+void server::add_connection(const shared_ptr<connection>& c)
+{
+	lock_guard<mutex> lg(connections_mutex);
+	connections.emplace(c.get(), c);
+}
+
+void server::remove_connection(const connection* c)
+{
+	lock_guard<mutex> lg(connections_mutex);
+	connections.erase(c);
+}
+
+void server::write_metrics(ostream& os) const
+{
+	write_histogram(os, "slither_serialize_us", "", serialize_us);
+	write_histogram(os, "slither_package_bytes", "", package_bytes);
+	write_histogram(os, "slither_queue_depth", "", queue_depth);
+	write_histogram(os, "slither_dropped_frames", "", dropped_frames);
+	write_histogram(os, "slither_input_latency_us", "", input_latency_us);
+
+	/* Written unlocked: dropping the last reference here runs the destructor, which locks */
+	vector<shared_ptr<connection>> live;
+	{
+		lock_guard<mutex> lg(connections_mutex);
+		for (auto &i : connections)
 		{
-			break;
+			if (auto c = i.second.lock())
+			{
+				live.push_back(c);
+			}
 		}
 	}
-	if (!pkg_queue)
+	write_metric(os, "slither_connections", "", live.size());
+	for (auto &c : live)
 	{
-		timer.start_once();
+		ostringstream labels;
+		labels << "connection=\"" << c.get() << "\",player=\"" << c->player_id << "\"";
+		write_metric(os, "slither_connection_bytes_sent", labels.str(), c->bytes_sent);
+		write_metric(os, "slither_connection_packages_sent", labels.str(), c->packages_sent);
+		write_metric(os, "slither_connection_queue_depth", labels.str(), c->get_queue_depth());
+		write_metric(os, "slither_connection_queued_bytes", labels.str(), c->get_queued_bytes());
+		write_metric(os, "slither_connection_frames_dropped", labels.str(), c->frames_dropped);
+		write_metric(os, "slither_connection_input_latency_us", labels.str(), c->input_latency_us);
 	}
 }
@@ -4,16 +4,33 @@
 #include <memory>
 #include <boost/asio.hpp>
 #include <map>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <ostream>
+#include <array>
+#include <chrono>
 #include "common.hpp"
+#include "stats.hpp"
+#include "game.hpp"
+#include "view.hpp"
+#include "mailbox.hpp"
 
-
-namespace game_logic { class game; class player; class field; }
 namespace userdb { class user_db; }
 namespace flatbuffers { class FlatBufferBuilder; }
 namespace SnakeGame { class Login; class Direction; }
 
 namespace network
 {
+	class delta_encoder;
+
+	/* Length-prefixed package as written to the socket; shared between connections */
+	typedef std::shared_ptr<const std::vector<char>> package_buffer;
+	package_buffer make_package_buffer(const flatbuffers::FlatBufferBuilder& fbb);
+
+	class connection;
+
 	class server : public std::enable_shared_from_this<server>
 	{
 		private:
@@ -23,7 +40,23 @@ namespace network
 			boost::asio::ip::tcp::socket socket;
 			void do_accept();
 
+			/* Live connections, for the metrics */
+			mutable std::mutex connections_mutex;
+			std::map<const connection*, std::weak_ptr<connection>> connections;
+
 		public:
+			/* Over all connections: time to build a Field package, package sizes,
+			   the write queue after each send, and ticks skipped between two Fields */
+			latency_histogram serialize_us, package_bytes, queue_depth, dropped_frames;
+			/* From sending a Field to getting a Direction that echoes its tick */
+			latency_histogram input_latency_us;
+			/* Applied to the Field and CompactField packages of players; set before the first connection */
+			skeleton_lod lod;
+
+			void add_connection(const std::shared_ptr<connection>& c);
+			void remove_connection(const connection* c);
+			void write_metrics(std::ostream& os) const;
+
 			server(boost::asio::io_service& _ios, const boost::asio::ip::tcp::endpoint& _endpoint);
 			std::shared_ptr<userdb::user_db> get_users() const;
 			void set_users(const std::shared_ptr<userdb::user_db>& _users);
@@ -31,19 +64,46 @@ namespace network
 			void add_game(int field, const std::shared_ptr<game_logic::game>& game);
 	};
 
-	class connection : public std::enable_shared_from_this<connection>
+	/* Fields come from the game right after each tick and are sent in the order of
+	   the strand; a client that is still reading the previous one gets the latest */
+	class connection : public game_logic::field_subscriber, public std::enable_shared_from_this<connection>
 	{
 		private:
 			std::shared_ptr<server> srv;
 			boost::asio::ip::tcp::socket sock;
+			/* All handlers of the connection run on it, so they never race with each other */
+			boost::asio::io_service::strand strand;
 			char current_length_buf[4];
 			std::vector<char> current_body_read_buf;
-			std::vector<char> current_write_buf;
 			std::shared_ptr<game_logic::game> game;
 			std::shared_ptr<game_logic::player> player;
-			periodic_timer timer;
-			int pkg_queue;
+			/* The newest field not sent yet; set from the tick thread. A client that does
+			   not keep up gets the latest field once its previous one is written. */
+			field_mailbox mailbox;
+			void deliver();
+			/* Packages waiting for the socket */
+			std::deque<package_buffer> out_queue;
+			/* Packages of the write in flight, empty while the socket is idle */
+			std::vector<package_buffer> writing;
+			bool write_failed = false;
+			/* Queued and in-flight packages and their bytes; read by the metrics too */
+			std::atomic<int> pkg_queue;
+			std::atomic<size_t> queued_bytes{0};
+			/* Tick of the last Field sent */
+			int last_tick = -1;
+			/* Recent Fields sent, by tick modulo the size, and when */
+			std::array<std::pair<int, std::chrono::steady_clock::time_point>, 8> sent_ticks;
+			/* Tick echoed by the last Direction, sent back in every Field */
+			int input_tick = -1;
 			int level = 0;
+			/* Set when the client asked for FieldDelta packages */
+			bool delta = false;
+			/* One baseline per own snake, by the snake_id of the packages; a new one starts with a keyframe */
+			std::map<int, std::unique_ptr<delta_encoder>> encoders;
+			/* Set when the client asked for one package per tick for all its snakes */
+			bool bundle = false;
+			/* Set when the client asked for CompactField packages instead of Field */
+			bool compact = false;
 
 			void do_read_header();
 			void do_read_body();
@@ -52,13 +112,26 @@ namespace network
 			void handle_direction(const SnakeGame::Direction* pkg);
 			void error(const std::string& text);
 			void do_send_welcome();
+			void do_write();
+			void close_writes();
 
 		public:
 			connection(const std::shared_ptr<server>& _srv, boost::asio::ip::tcp::socket _sock);
 			~connection();
 			void start();
 			void send_package(const flatbuffers::FlatBufferBuilder& fbb);
+			/* Packages are written in order, several per write */
+			void send_package(const package_buffer& buf);
 			void send_field(const std::shared_ptr<game_logic::field>& field);
+			void on_field(const std::shared_ptr<game_logic::field>& f) override;
+
+			/* Read by the metrics endpoint from any thread */
+			std::atomic<int> player_id{-1};
+			std::atomic<uint64_t> bytes_sent{0}, packages_sent{0}, frames_dropped{0};
+			/* Of the last timed Direction; -1 before the first */
+			std::atomic<int64_t> input_latency_us{-1};
+			int get_queue_depth() const;
+			size_t get_queued_bytes() const;
 	};
 }
 
@@ -0,0 +1,124 @@
+#include "pool.hpp"
+
+using namespace game_logic;
+using namespace std;
+
+task_pool::task_pool(int threads):
+	ranges(new range[max(1, threads)])
+{
+	for (int i = 1; i < threads; ++i)
+	{
+		workers.emplace_back([this, i]() { worker(i); });
+	}
+}
+
+task_pool::~task_pool()
+{
+	{
+		lock_guard<mutex> lg(m);
+		stop = true;
+	}
+	start_cv.notify_all();
+	for (auto &i : workers)
+	{
+		i.join();
+	}
+}
+
+int task_pool::size() const
+{
+	return workers.size() + 1;
+}
+
+void task_pool::run(size_t chunks, const function<void(size_t)>& f)
+{
+	unique_lock<mutex> run_lock(run_mutex, try_to_lock);
+	if (!run_lock || workers.empty() || chunks < 2)
+	{
+		for (size_t c = 0; c < chunks; ++c)
+		{
+			f(c);
+		}
+		return;
+	}
+
+	/* Workers are idle between runs, so the ranges can be set without their locks */
+	size_t n = size();
+	for (size_t i = 0; i < n; ++i)
+	{
+		ranges[i].begin = chunks * i / n;
+		ranges[i].end = chunks * (i + 1) / n;
+	}
+	{
+		lock_guard<mutex> lg(m);
+		job = &f;
+		busy = workers.size();
+		++generation;
+	}
+	start_cv.notify_all();
+
+	work(0);
+
+	unique_lock<mutex> l(m);
+	done_cv.wait(l, [this]() { return busy == 0; });
+	job = nullptr;
+}
+
+void task_pool::worker(int idx)
+{
+	size_t seen = 0;
+	unique_lock<mutex> l(m);
+	for (;;)
+	{
+		start_cv.wait(l, [&]() { return stop || generation != seen; });
+		if (stop)
+		{
+			return;
+		}
+		seen = generation;
+		l.unlock();
+		work(idx);
+		l.lock();
+		if (--busy == 0)
+		{
+			done_cv.notify_one();
+		}
+	}
+}
+
+void task_pool::work(int idx)
+{
+	size_t chunk;
+	while (take(idx, chunk) || steal(idx, chunk))
+	{
+		(*job)(chunk);
+	}
+}
+
+bool task_pool::take(int idx, size_t& chunk)
+{
+	range &r = ranges[idx];
+	lock_guard<mutex> lg(r.m);
+	if (r.begin == r.end)
+	{
+		return false;
+	}
+	chunk = r.begin++;
+	return true;
+}
+
+bool task_pool::steal(int idx, size_t& chunk)
+{
+	int n = size();
+	for (int i = 1; i < n; ++i)
+	{
+		range &r = ranges[(idx + i) % n];
+		lock_guard<mutex> lg(r.m);
+		if (r.begin != r.end)
+		{
+			chunk = --r.end;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,77 @@
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace game_logic
+{
+	/* Worker threads for the parallel phases of a tick. Each run hands every
+	   thread a contiguous range of chunks; a thread that runs out steals
+	   chunks from the back of the others' ranges. */
+	class task_pool
+	{
+		public:
+			/* The thread calling run() works too, so threads - 1 workers are started */
+			explicit task_pool(int threads);
+			~task_pool();
+
+			int size() const;
+
+			/* Calls f(c) for every c < chunks and returns when all calls are done.
+			   A pool busy with another run executes the chunks on the calling thread. */
+			void run(size_t chunks, const std::function<void(size_t)>& f);
+
+		private:
+			struct range
+			{
+				std::mutex m;
+				size_t begin = 0, end = 0;
+			};
+
+			std::vector<std::thread> workers;
+			std::unique_ptr<range[]> ranges;
+			std::mutex run_mutex;
+
+			std::mutex m;
+			std::condition_variable start_cv, done_cv;
+			const std::function<void(size_t)> *job = nullptr;
+			size_t generation = 0;
+			int busy = 0;
+			bool stop = false;
+
+			void worker(int idx);
+			void work(int idx);
+			bool take(int idx, size_t& chunk);
+			bool steal(int idx, size_t& chunk);
+	};
+
+	/* Splits [0, n) into chunks of grain items and calls f(begin, end, chunk) for each.
+	   The chunks do not depend on the pool, so per-chunk results merged in chunk
+	   order are the same with any number of threads, or with no pool at all. */
+	template<class F>
+	void parallel_for(task_pool *pool, size_t n, size_t grain, F f)
+	{
+		size_t chunks = (n + grain - 1) / grain;
+		auto body = [&](size_t c)
+			{
+				f(c * grain, std::min(n, (c + 1) * grain), c);
+			};
+		if (!pool)
+		{
+			for (size_t c = 0; c < chunks; ++c)
+			{
+				body(c);
+			}
+			return;
+		}
+		pool->run(chunks, body);
+	}
+}
+
+#endif
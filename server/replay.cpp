@@ -0,0 +1,614 @@
+#include "replay.hpp"
+#include "common.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+using namespace replay;
+using namespace std;
+using game_logic::point;
+using game_logic::food;
+
+static const uint32_t replay_version = 1;
+
+namespace
+{
+	struct out
+	{
+		vector<char>& buf;
+
+		template<class T> void put(const T& v)
+		{
+			const char *p = reinterpret_cast<const char*>(&v);
+			buf.insert(buf.end(), p, p + sizeof(T));
+		}
+
+		void put_varint(uint64_t v)
+		{
+			for (; v >= 0x80; v >>= 7)
+			{
+				buf.push_back(static_cast<char>(v | 0x80));
+			}
+			buf.push_back(static_cast<char>(v));
+		}
+	};
+
+	struct in
+	{
+		const char *p, *end;
+
+		template<class T> T get()
+		{
+			if (static_cast<size_t>(end - p) < sizeof(T))
+			{
+				throw runtime_error("Truncated replay record");
+			}
+			T v;
+			memcpy(&v, p, sizeof(T));
+			p += sizeof(T);
+			return v;
+		}
+
+		uint64_t get_varint()
+		{
+			uint64_t v = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				uint8_t b = get<uint8_t>();
+				v |= static_cast<uint64_t>(b & 0x7f) << shift;
+				if (!(b & 0x80))
+				{
+					return v;
+				}
+			}
+			throw runtime_error("Bad varint in replay record");
+		}
+	};
+
+	/* Bit equality, so that NaN and -0 survive the round trip */
+	bool same(const point& a, const point& b)
+	{
+		return memcmp(&a.x, &b.x, sizeof(a.x)) == 0 && memcmp(&a.y, &b.y, sizeof(a.y)) == 0;
+	}
+
+	bool same(const food& a, const food& b)
+	{
+		return same(a.p, b.p) && memcmp(&a.w, &b.w, sizeof(a.w)) == 0 && a.id == b.id;
+	}
+
+	void put_food(out& o, const food& f)
+	{
+		o.put(f.p.x);
+		o.put(f.p.y);
+		o.put(f.w);
+		o.put<int32_t>(f.id);
+	}
+
+	food get_food(in& i)
+	{
+		food f;
+		f.p.x = i.get<float>();
+		f.p.y = i.get<float>();
+		f.w = i.get<float>();
+		f.id = i.get<int32_t>();
+		return f;
+	}
+
+	/* Runs of points equal to the base at the same index, each followed by a run of new points */
+	template<class Points>
+	void put_points(out& o, const Points& cur, const point* base, size_t base_size)
+	{
+		size_t n = cur.size();
+		o.put_varint(n);
+		for (size_t k = 0; k < n;)
+		{
+			size_t from = k;
+			for (; k < n && k < base_size && same(cur[k], base[k]); ++k)
+			{
+			}
+			o.put_varint(k - from);
+			from = k;
+			for (; k < n && !(k < base_size && same(cur[k], base[k])); ++k)
+			{
+			}
+			o.put_varint(k - from);
+			for (size_t j = from; j < k; ++j)
+			{
+				o.put(cur[j].x);
+				o.put(cur[j].y);
+			}
+		}
+	}
+
+	void get_points(in& i, vector<point>& cur, const vector<point>* base)
+	{
+		size_t n = i.get_varint();
+		cur.clear();
+		while (cur.size() < n)
+		{
+			size_t copy = i.get_varint();
+			if (copy)
+			{
+				if (!base || cur.size() + copy > base->size())
+				{
+					throw runtime_error("Bad skeleton in replay record");
+				}
+				cur.insert(cur.end(), base->begin() + cur.size(), base->begin() + cur.size() + copy);
+			}
+			for (size_t literal = i.get_varint(); literal; --literal)
+			{
+				float x = i.get<float>();
+				cur.emplace_back(x, i.get<float>());
+			}
+		}
+		if (cur.size() != n)
+		{
+			throw runtime_error("Bad skeleton in replay record");
+		}
+	}
+}
+
+writer::writer(const string& _dir, const game_logic::configuration& cfg, bool started, size_t _max_pending):
+	dir(_dir), max_pending(_max_pending)
+{
+	if (mkdir(dir.c_str(), 0755) && errno != EEXIST)
+	{
+		throw runtime_error("Cannot create replay directory " + dir);
+	}
+	index = fopen((dir + "/index").c_str(), "wb");
+	if (!index)
+	{
+		throw runtime_error("Cannot create replay index in " + dir);
+	}
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, "SLRP", 4);
+	head.version = replay_version;
+	head.seed = cfg.seed;
+	head.min_foods = cfg.min_foods;
+	head.tick_ms = cfg.tick_ms;
+	head.k_10 = cfg.k_10;
+	head.started = started;
+	head.first_tick = -1;
+	head.ticks_per_segment = ticks_per_segment;
+	head.keyframe_interval = keyframe_interval;
+	thread = std::thread([this]() { run(); });
+	dlog(info) << "Recording to " << dir;
+}
+
+writer::~writer()
+{
+	{
+		lock_guard<mutex> lg(m);
+		stop = true;
+	}
+	cv.notify_one();
+	thread.join();
+	if (segment)
+	{
+		fclose(segment);
+	}
+	fclose(index);
+}
+
+void writer::on_tick(const game_logic::tick_input& in, const shared_ptr<game_logic::field>& f)
+{
+	if (failed)
+	{
+		return;
+	}
+	{
+		lock_guard<mutex> lg(m);
+		if (pending.size() >= max_pending)
+		{
+			failed = true;
+			dlog(warning) << "Replay writer is " << pending.size() << " ticks behind; recording to " << dir << " stopped";
+			return;
+		}
+		pending.push_back(item{in, f});
+	}
+	cv.notify_one();
+}
+
+void writer::run()
+{
+	deque<item> batch;
+	for (;;)
+	{
+		{
+			unique_lock<mutex> l(m);
+			cv.wait(l, [this]() { return stop || !pending.empty(); });
+			if (pending.empty())
+			{
+				return;
+			}
+			batch.swap(pending);
+		}
+		for (auto &i : batch)
+		{
+			if (!failed)
+			{
+				write(i);
+			}
+		}
+		batch.clear();
+		/* The index is flushed last, so its entries never point past the data */
+		if (!failed && ((segment && fflush(segment)) || fflush(index)))
+		{
+			fail("flush");
+		}
+	}
+}
+
+void writer::fail(const string& what)
+{
+	failed = true;
+	dlog(warning) << "Replay " << what << " failed: " << strerror(errno) << "; recording to " << dir << " stopped";
+}
+
+void writer::write(const item& i)
+{
+	const game_logic::field &f = *i.f;
+	if (head.first_tick < 0)
+	{
+		head.first_tick = f.tick;
+		if (fwrite(&head, sizeof(head), 1, index) != 1)
+		{
+			return fail("index write");
+		}
+	}
+	uint32_t n = f.tick - head.first_tick;
+	if (!segment || n / ticks_per_segment != segment_no)
+	{
+		if (segment && fclose(segment))
+		{
+			segment = nullptr;
+			return fail("segment close");
+		}
+		segment_no = n / ticks_per_segment;
+		segment_size = 0;
+		segment = fopen((dir + "/segment." + to_string(segment_no)).c_str(), "wb");
+		if (!segment)
+		{
+			return fail("segment open");
+		}
+	}
+	/* Segments start with a keyframe, so each can be read alone */
+	bool key = n % keyframe_interval == 0 || !prev;
+
+	record.clear();
+	out o{record};
+	o.put<int32_t>(f.tick);
+	o.put(f.time);
+	o.put<uint64_t>(f.hash());
+	o.put<uint8_t>(key);
+
+	o.put_varint(i.in.joins.size());
+	for (auto &j : i.in.joins)
+	{
+		o.put_varint(j.first.size());
+		record.insert(record.end(), j.first.begin(), j.first.end());
+		o.put<int32_t>(j.second);
+	}
+	o.put_varint(i.in.directions.size());
+	for (auto &j : i.in.directions)
+	{
+		const game_logic::direction &d = get<2>(j);
+		o.put<int32_t>(get<0>(j));
+		o.put<int32_t>(get<1>(j));
+		o.put(d.p.x);
+		o.put(d.p.y);
+		o.put<uint8_t>(d.boost | d.split << 1);
+	}
+
+	map<pair<int, int>, const game_logic::snake*> base;
+	if (!key)
+	{
+		for (auto &j : prev->snakes)
+		{
+			base[make_pair(j.p->get_id(), j.id)] = &j;
+		}
+	}
+	o.put_varint(f.snakes.size());
+	for (auto &j : f.snakes)
+	{
+		o.put<int32_t>(j.p->get_id());
+		o.put<int32_t>(j.id);
+		o.put(j.w);
+		o.put(j.r);
+		o.put(j.speed);
+		o.put<uint8_t>(j.boost);
+		auto b = base.find(make_pair(j.p->get_id(), j.id));
+		if (b != base.end())
+		{
+			put_points(o, j.skeleton, b->second->skeleton.data(), b->second->skeleton.size());
+		}
+		else
+		{
+			put_points(o, j.skeleton, nullptr, 0);
+		}
+	}
+
+	/* Foods: runs of skipped and kept old foods, each followed by a run of new ones */
+	unordered_map<int, size_t> ids;
+	if (!key)
+	{
+		for (size_t k = 0; k < prev->foods.size(); ++k)
+		{
+			ids[prev->foods[k].id] = k;
+		}
+	}
+	size_t old = 0;
+	auto kept = [&](size_t k) -> size_t
+		{
+			auto it = ids.find(f.foods[k].id);
+			return it != ids.end() && it->second >= old && same(prev->foods[it->second], f.foods[k]) ? it->second : string::npos;
+		};
+	o.put_varint(f.foods.size());
+	for (size_t k = 0; k < f.foods.size();)
+	{
+		size_t skip = 0, copy = 0, at = kept(k);
+		if (at != string::npos)
+		{
+			skip = at - old;
+			for (old = at; k < f.foods.size() && old < prev->foods.size() && same(prev->foods[old], f.foods[k]); ++old, ++k)
+			{
+				++copy;
+			}
+		}
+		size_t from = k;
+		for (; k < f.foods.size() && kept(k) == string::npos; ++k)
+		{
+		}
+		o.put_varint(skip);
+		o.put_varint(copy);
+		o.put_varint(k - from);
+		for (size_t j = from; j < k; ++j)
+		{
+			put_food(o, f.foods[j]);
+		}
+	}
+
+	index_entry e;
+	e.segment = segment_no;
+	e.size = record.size();
+	e.offset = segment_size;
+	if (fwrite(record.data(), 1, record.size(), segment) != record.size())
+	{
+		return fail("segment write");
+	}
+	segment_size += record.size();
+	if (fwrite(&e, sizeof(e), 1, index) != 1)
+	{
+		return fail("index write");
+	}
+	prev = i.f;
+}
+
+uint64_t frame::compute_hash() const
+{
+	/* The same values in the same order as field::hash */
+	game_logic::fnv f;
+	f.add(tick);
+	for (auto &i : snakes)
+	{
+		f.add(i.player);
+		f.add(i.id);
+		f.add(i.w);
+		f.add(i.r);
+		f.add(i.speed);
+		f.add(i.boost);
+		for (auto &j : i.skeleton)
+		{
+			f.add(j.x);
+			f.add(j.y);
+		}
+	}
+	for (auto &i : foods)
+	{
+		f.add(i.p.x);
+		f.add(i.p.y);
+		f.add(i.w);
+	}
+	return f.h;
+}
+
+reader::mapping reader::map_file(const string& path)
+{
+	mapping r;
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		throw runtime_error("Cannot open " + path);
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED)
+		{
+			r.data = static_cast<const char*>(p);
+			r.size = st.st_size;
+		}
+	}
+	close(fd);
+	if (!r.data)
+	{
+		throw runtime_error("Cannot map " + path);
+	}
+	return r;
+}
+
+void reader::unmap(const mapping& m)
+{
+	if (m.data)
+	{
+		munmap(const_cast<char*>(m.data), m.size);
+	}
+}
+
+reader::reader(const string& _dir):
+	dir(_dir)
+{
+	index = map_file(dir + "/index");
+	if (index.size < sizeof(header) || memcmp(get_header().magic, "SLRP", 4) || get_header().version != replay_version)
+	{
+		unmap(index);
+		throw runtime_error("Not a replay index: " + dir);
+	}
+	/* An entry cut short by a crash is not counted */
+	ticks = (index.size - sizeof(header)) / sizeof(index_entry);
+	if (!ticks)
+	{
+		unmap(index);
+		throw runtime_error("Empty replay: " + dir);
+	}
+}
+
+reader::~reader()
+{
+	unmap(index);
+	for (auto &i : segments)
+	{
+		unmap(i);
+	}
+}
+
+const header& reader::get_header() const
+{
+	return *reinterpret_cast<const header*>(index.data);
+}
+
+int reader::first_tick() const
+{
+	return get_header().first_tick;
+}
+
+int reader::last_tick() const
+{
+	return first_tick() + ticks - 1;
+}
+
+const index_entry& reader::entry(int tick) const
+{
+	return reinterpret_cast<const index_entry*>(index.data + sizeof(header))[tick - first_tick()];
+}
+
+const frame& reader::seek(int tick)
+{
+	if (tick < first_tick() || tick > last_tick())
+	{
+		throw out_of_range("Tick " + to_string(tick) + " is not in " + dir);
+	}
+	int key = tick - (tick - first_tick()) % get_header().keyframe_interval;
+	int from = cur.tick >= key && cur.tick <= tick ? cur.tick + 1 : key;
+	for (int t = from; t <= tick; ++t)
+	{
+		decode(t);
+	}
+	return cur;
+}
+
+void reader::decode(int tick)
+{
+	const index_entry &e = entry(tick);
+	if (e.segment >= segments.size())
+	{
+		segments.resize(e.segment + 1);
+	}
+	if (!segments[e.segment].data)
+	{
+		segments[e.segment] = map_file(dir + "/segment." + to_string(e.segment));
+	}
+	const mapping &s = segments[e.segment];
+	if (e.offset > s.size || e.size > s.size - e.offset)
+	{
+		throw runtime_error("Replay record of tick " + to_string(tick) + " is past the end of its segment");
+	}
+
+	swap(prev, cur);
+	in i{s.data + e.offset, s.data + e.offset + e.size};
+	cur.tick = i.get<int32_t>();
+	cur.time = i.get<float>();
+	cur.hash = i.get<uint64_t>();
+	bool key = i.get<uint8_t>();
+	if (cur.tick != tick || (!key && prev.tick != tick - 1))
+	{
+		throw runtime_error("Replay record of tick " + to_string(tick) + " is out of order");
+	}
+
+	cur.in.joins.resize(i.get_varint());
+	for (auto &j : cur.in.joins)
+	{
+		size_t len = i.get_varint();
+		if (static_cast<size_t>(i.end - i.p) < len)
+		{
+			throw runtime_error("Truncated replay record");
+		}
+		j.first.assign(i.p, len);
+		i.p += len;
+		j.second = i.get<int32_t>();
+	}
+	cur.in.directions.resize(i.get_varint());
+	for (auto &j : cur.in.directions)
+	{
+		game_logic::direction d;
+		get<0>(j) = i.get<int32_t>();
+		get<1>(j) = i.get<int32_t>();
+		d.p.x = i.get<float>();
+		d.p.y = i.get<float>();
+		uint8_t flags = i.get<uint8_t>();
+		d.boost = flags & 1;
+		d.split = flags & 2;
+		get<2>(j) = d;
+	}
+
+	map<pair<int, int>, const snake_state*> base;
+	if (!key)
+	{
+		for (auto &j : prev.snakes)
+		{
+			base[make_pair(j.player, j.id)] = &j;
+		}
+	}
+	cur.snakes.resize(i.get_varint());
+	for (auto &j : cur.snakes)
+	{
+		j.player = i.get<int32_t>();
+		j.id = i.get<int32_t>();
+		j.w = i.get<float>();
+		j.r = i.get<float>();
+		j.speed = i.get<float>();
+		j.boost = i.get<uint8_t>();
+		auto b = base.find(make_pair(j.player, j.id));
+		get_points(i, j.skeleton, b != base.end() ? &b->second->skeleton : nullptr);
+	}
+
+	size_t n = i.get_varint(), old = 0;
+	const vector<food> empty, &prev_foods = key ? empty : prev.foods;
+	cur.foods.clear();
+	while (cur.foods.size() < n)
+	{
+		old += i.get_varint();
+		size_t copy = i.get_varint();
+		if (old > prev_foods.size() || copy > prev_foods.size() - old)
+		{
+			throw runtime_error("Bad foods in replay record");
+		}
+		cur.foods.insert(cur.foods.end(), prev_foods.begin() + old, prev_foods.begin() + old + copy);
+		old += copy;
+		for (size_t literal = i.get_varint(); literal; --literal)
+		{
+			cur.foods.push_back(get_food(i));
+		}
+	}
+	if (cur.foods.size() != n)
+	{
+		throw runtime_error("Bad foods in replay record");
+	}
+}
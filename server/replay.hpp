@@ -0,0 +1,148 @@
+#ifndef REPLAY_HPP
+#define REPLAY_HPP
+
+#include "game.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/* A recording is a directory with an index and numbered segments. The index is a
+   header and then one fixed-size entry per tick, so any tick is found at once.
+   Segments hold one record per tick: the inputs of the tick and the field it made,
+   which is a keyframe every keyframe_interval ticks and else the difference to
+   the field of the previous tick. */
+namespace replay
+{
+	struct header
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t seed;
+		int32_t min_foods;
+		int32_t tick_ms;
+		float k_10;
+		/* The game had started when recording began */
+		uint8_t started;
+		uint8_t reserved[3];
+		int32_t first_tick;
+		uint32_t ticks_per_segment;
+		uint32_t keyframe_interval;
+	};
+
+	struct index_entry
+	{
+		uint32_t segment;
+		uint32_t size;
+		uint64_t offset;
+	};
+
+	/* Writes the ticks of one game on its own thread. Recording stops, with a
+	   warning, when the writer falls behind or the disk fails; the game never waits. */
+	class writer : public game_logic::tick_recorder
+	{
+		public:
+			/* Attached to a game that has not ticked yet; recording stops when
+			   more than _max_pending ticks wait for the writer */
+			writer(const std::string& _dir, const game_logic::configuration& cfg, bool started,
+				size_t _max_pending = default_max_pending);
+			~writer();
+			void on_tick(const game_logic::tick_input& in, const std::shared_ptr<game_logic::field>& f) override;
+
+			static const uint32_t ticks_per_segment = 4096;
+			static const uint32_t keyframe_interval = 64;
+			static const size_t default_max_pending = 64;
+
+		private:
+			struct item
+			{
+				game_logic::tick_input in;
+				std::shared_ptr<game_logic::field> f;
+			};
+
+			std::string dir;
+			size_t max_pending;
+			header head;
+			std::mutex m;
+			std::condition_variable cv;
+			std::deque<item> pending;
+			bool stop = false;
+			std::atomic<bool> failed{false};
+			std::thread thread;
+
+			/* Writer thread only */
+			FILE *index = nullptr, *segment = nullptr;
+			uint32_t segment_no = 0;
+			uint64_t segment_size = 0;
+			std::shared_ptr<game_logic::field> prev;
+			std::vector<char> record;
+
+			void run();
+			void write(const item& i);
+			void fail(const std::string& what);
+	};
+
+	struct snake_state
+	{
+		int player, id;
+		float w, r, speed;
+		bool boost;
+		std::vector<game_logic::point> skeleton;
+	};
+
+	/* One tick as recorded: what it was given and the field it made */
+	struct frame
+	{
+		int tick = -1;
+		float time = 0;
+		/* field::hash of the recorded field */
+		uint64_t hash = 0;
+		game_logic::tick_input in;
+		std::vector<snake_state> snakes;
+		std::vector<game_logic::food> foods;
+		/* field::hash of this frame; equals hash when the record is intact */
+		uint64_t compute_hash() const;
+	};
+
+	/* Maps a recording and decodes any tick of it, from the keyframe before it */
+	class reader
+	{
+		public:
+			explicit reader(const std::string& _dir);
+			~reader();
+			reader(const reader&) = delete;
+			reader& operator=(const reader&) = delete;
+
+			const header& get_header() const;
+			/* Recorded ticks are first_tick() .. last_tick() */
+			int first_tick() const;
+			int last_tick() const;
+			/* Valid until the next seek; reading the ticks in order decodes each once */
+			const frame& seek(int tick);
+
+		private:
+			struct mapping
+			{
+				const char *data = nullptr;
+				size_t size = 0;
+			};
+
+			std::string dir;
+			mapping index;
+			std::vector<mapping> segments;
+			size_t ticks;
+			frame cur, prev;
+
+			static mapping map_file(const std::string& path);
+			static void unmap(const mapping& m);
+			const index_entry& entry(int tick) const;
+			void decode(int tick);
+	};
+}
+
+#endif
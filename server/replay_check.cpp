@@ -0,0 +1,211 @@
+#include "game.hpp"
+#include "replay.hpp"
+#include "common.hpp"
+#include <boost/log/expressions.hpp>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace game_logic;
+using namespace std;
+
+/* Regression check: feeds the inputs of a recording to a fresh game and compares
+   every field it makes with the recorded one, so a change to the tick can be shown
+   to keep the game bit for bit.
+   replay_check [options] recording...
+	-j N       run the parallel tick phases on N threads
+	--ticks N  check only the first N recorded ticks
+   A recording is made by bench --record or server --record; it must start at the first tick. */
+struct options
+{
+	shared_ptr<task_pool> pool;
+	int ticks = 0;
+	vector<string> recordings;
+};
+
+template<class T> static bool same(const T& a, const T& b)
+{
+	return memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+/* The first place where a field differs from the recorded frame */
+static string difference(const field& f, const replay::frame& r)
+{
+	ostringstream os;
+	if (f.snakes.size() != r.snakes.size())
+	{
+		os << "snakes " << f.snakes.size() << " != " << r.snakes.size();
+		return os.str();
+	}
+	for (size_t i = 0; i < r.snakes.size(); ++i)
+	{
+		const snake &s = f.snakes[i];
+		const replay::snake_state &e = r.snakes[i];
+		os << "snake " << e.player << "/" << e.id << ": ";
+		if (s.p->get_id() != e.player || s.id != e.id)
+		{
+			os << "is " << s.p->get_id() << "/" << s.id;
+			return os.str();
+		}
+		if (!same(s.w, e.w) || !same(s.r, e.r) || !same(s.speed, e.speed) || s.boost != e.boost)
+		{
+			os << "w=" << s.w << " r=" << s.r << " speed=" << s.speed << " boost=" << s.boost
+				<< ", recorded w=" << e.w << " r=" << e.r << " speed=" << e.speed << " boost=" << e.boost;
+			return os.str();
+		}
+		if (s.skeleton.size() != e.skeleton.size())
+		{
+			os << "skeleton " << s.skeleton.size() << " != " << e.skeleton.size();
+			return os.str();
+		}
+		for (size_t j = 0; j < e.skeleton.size(); ++j)
+		{
+			if (!same(s.skeleton[j].x, e.skeleton[j].x) || !same(s.skeleton[j].y, e.skeleton[j].y))
+			{
+				os << "point " << j << " (" << s.skeleton[j].x << ", " << s.skeleton[j].y << ") != ("
+					<< e.skeleton[j].x << ", " << e.skeleton[j].y << ")";
+				return os.str();
+			}
+		}
+		os.str("");
+	}
+	if (f.foods.size() != r.foods.size())
+	{
+		os << "foods " << f.foods.size() << " != " << r.foods.size();
+		return os.str();
+	}
+	for (size_t i = 0; i < r.foods.size(); ++i)
+	{
+		const food &a = f.foods[i], &b = r.foods[i];
+		if (!same(a.p.x, b.p.x) || !same(a.p.y, b.p.y) || !same(a.w, b.w))
+		{
+			os << "food " << i << " (" << a.p.x << ", " << a.p.y << ") w=" << a.w
+				<< " != (" << b.p.x << ", " << b.p.y << ") w=" << b.w;
+			return os.str();
+		}
+	}
+	return "no difference found, the hash function itself differs";
+}
+
+/* Returns the first tick that differs, or 0 when all match */
+static int check(const options& o, const string& dir)
+{
+	replay::reader rd(dir);
+	const replay::header &h = rd.get_header();
+	if (rd.first_tick() != 1)
+	{
+		throw runtime_error(dir + " starts at tick " + to_string(rd.first_tick()) + ", not at the first one");
+	}
+	auto cfg = default_configuration();
+	cfg.seed = h.seed;
+	cfg.min_foods = h.min_foods;
+	cfg.tick_ms = h.tick_ms;
+	cfg.k_10 = h.k_10;
+	game g(cfg);
+	g.set_task_pool(o.pool);
+	g.game_started = h.started != 0;
+
+	/* Recorded inputs name players by id; ids are given in the order of joins */
+	unordered_map<int, player*> players;
+	int last = o.ticks ? min(rd.last_tick(), rd.first_tick() + o.ticks - 1) : rd.last_tick();
+	double total_ms = 0;
+	int bad = 0;
+	for (int t = rd.first_tick(); t <= last; ++t)
+	{
+		const replay::frame &r = rd.seek(t);
+		if (r.compute_hash() != r.hash)
+		{
+			throw runtime_error(dir + " is damaged at tick " + to_string(t));
+		}
+		for (auto &i : r.in.joins)
+		{
+			auto p = g.get_player(i.first, i.second);
+			players[p->get_id()] = p.get();
+		}
+		for (auto &i : r.in.directions)
+		{
+			auto it = players.find(get<0>(i));
+			if (it == players.end())
+			{
+				throw runtime_error(dir + " directs unknown player " + to_string(get<0>(i)) + " at tick " + to_string(t));
+			}
+			g.set_direction(it->second, get<1>(i), get<2>(i));
+		}
+		auto start = chrono::steady_clock::now();
+		int made = g.tick();
+		total_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		auto f = g.get_current_field();
+		if (made != t || f->hash() != r.hash)
+		{
+			cout << dir << ": tick " << t << " differs: "
+				<< (made != t ? "made tick " + to_string(made) : difference(*f, r)) << endl;
+			bad = t;
+			break;
+		}
+	}
+	int checked = (bad ? bad : last + 1) - rd.first_tick();
+	cout << dir << ": ticks=" << checked
+		<< " of=" << rd.last_tick() - rd.first_tick() + 1
+		<< " threads=" << (o.pool ? o.pool->size() : 1)
+		<< " ticks_per_s=" << (total_ms > 0 ? 1000 * checked / total_ms : 0)
+		<< " " << (bad ? "FAILED" : "ok") << endl;
+	return bad;
+}
+
+int main(int ac, char** av)
+{
+	boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+	options o;
+	int arg = 1;
+	for (; arg < ac && av[arg][0] == '-'; ++arg)
+	{
+		string name = av[arg];
+		if (arg + 1 >= ac)
+		{
+			cerr << "Missing value of " << name << endl;
+			return 2;
+		}
+		const char *value = av[++arg];
+		if (name == "-j")
+		{
+			o.pool = make_shared<task_pool>(max(1, atoi(value)));
+		}
+		else if (name == "--ticks")
+		{
+			o.ticks = max(0, atoi(value));
+		}
+		else
+		{
+			cerr << "Unknown option " << name << endl;
+			return 2;
+		}
+	}
+	for (; arg < ac; ++arg)
+	{
+		o.recordings.push_back(av[arg]);
+	}
+	if (o.recordings.empty())
+	{
+		cerr << "Usage: " << av[0] << " [-j N] [--ticks N] recording..." << endl;
+		return 2;
+	}
+
+	bool ok = true;
+	for (auto &dir : o.recordings)
+	{
+		try
+		{
+			ok = !check(o, dir) && ok;
+		}
+		catch (const exception& e)
+		{
+			cerr << e.what() << endl;
+			return 2;
+		}
+	}
+	return ok ? 0 : 1;
+}
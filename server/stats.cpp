@@ -0,0 +1,76 @@
+#include "stats.hpp"
+
+latency_histogram::latency_histogram()
+{
+	reset();
+}
+
+void latency_histogram::add(uint64_t us)
+{
+	int b = 0;
+	while (b + 1 < buckets && (1ULL << b) <= us)
+	{
+		++b;
+	}
+	counts[b].fetch_add(1, std::memory_order_relaxed);
+	total.fetch_add(1, std::memory_order_relaxed);
+	sum_us.fetch_add(us, std::memory_order_relaxed);
+	uint64_t m = max_us.load(std::memory_order_relaxed);
+	while (us > m && !max_us.compare_exchange_weak(m, us, std::memory_order_relaxed))
+	{
+	}
+}
+
+void latency_histogram::reset()
+{
+	for (auto &i : counts)
+	{
+		i = 0;
+	}
+	total = 0;
+	sum_us = 0;
+	max_us = 0;
+}
+
+uint64_t latency_histogram::count() const
+{
+	return total.load(std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::sum() const
+{
+	return sum_us.load(std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::max() const
+{
+	return max_us.load(std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::percentile(double q) const
+{
+	uint64_t n = count(), seen = 0;
+	if (!n)
+	{
+		return 0;
+	}
+	for (int b = 0; b < buckets; ++b)
+	{
+		seen += counts[b].load(std::memory_order_relaxed);
+		if (seen >= q * n)
+		{
+			return b ? 1ULL << b : 0;
+		}
+	}
+	return max();
+}
+
+uint64_t latency_histogram::bucket(int b) const
+{
+	return counts[b].load(std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::bucket_limit(int b)
+{
+	return 1ULL << b;
+}
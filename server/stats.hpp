@@ -0,0 +1,34 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <atomic>
+#include <cstdint>
+
+/* Lock-free histogram of durations in microseconds with power-of-two buckets;
+   also used for other non-negative counts such as sizes in bytes.
+   Any thread may add and read; a reset loses concurrent adds. */
+class latency_histogram
+{
+	public:
+		enum { buckets = 32 };
+
+		latency_histogram();
+		void add(uint64_t us);
+		void reset();
+
+		uint64_t count() const;
+		uint64_t sum() const;
+		uint64_t max() const;
+		/* Upper bound of the bucket holding the q-quantile, 0 <= q <= 1 */
+		uint64_t percentile(double q) const;
+
+		/* Bucket b holds values in [2^(b - 1), 2^b); bucket 0 holds zeros */
+		uint64_t bucket(int b) const;
+		static uint64_t bucket_limit(int b);
+
+	private:
+		std::atomic<uint64_t> counts[buckets];
+		std::atomic<uint64_t> total, sum_us, max_us;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "ticker.hpp"
+#include "game.hpp"
+#include "common.hpp"
+
+using namespace game_logic;
+using namespace std;
+
+/* Ticks between jitter reports in the log */
+static const int report_interval = 1024;
+
+ticker::ticker(int _field, const shared_ptr<game>& _game, chrono::milliseconds _period):
+	field(_field), g(_game), period(_period), stop(false)
+{
+}
+
+ticker::~ticker()
+{
+	stop = true;
+	if (thread.joinable())
+	{
+		thread.join();
+	}
+}
+
+void ticker::set_cb(const cb_t& _cb)
+{
+	cb = _cb;
+}
+
+void ticker::start()
+{
+	thread = std::thread([this]() { run(); });
+}
+
+const latency_histogram& ticker::get_lateness() const
+{
+	return lateness;
+}
+
+const latency_histogram& ticker::get_duration() const
+{
+	return duration;
+}
+
+void ticker::run()
+{
+	auto next = chrono::steady_clock::now() + period;
+	while (!stop)
+	{
+		this_thread::sleep_until(next);
+		auto start = chrono::steady_clock::now();
+		lateness.add(chrono::duration_cast<chrono::microseconds>(start - next).count());
+
+		int t = g->tick();
+		if (cb)
+		{
+			cb(t);
+		}
+
+		auto end = chrono::steady_clock::now();
+		duration.add(chrono::duration_cast<chrono::microseconds>(end - start).count());
+		if (duration.count() >= report_interval)
+		{
+			report();
+		}
+
+		/* An overrun delays the schedule instead of bursting to catch up */
+		next += period;
+		if (next < end)
+		{
+			next = end;
+		}
+	}
+}
+
+void ticker::report()
+{
+	dlog(info) << "Field " << field << " ticks=" << duration.count()
+		<< " late_us p50=" << lateness.percentile(0.5) << " p99=" << lateness.percentile(0.99) << " max=" << lateness.max()
+		<< " tick_us p50=" << duration.percentile(0.5) << " p99=" << duration.percentile(0.99) << " max=" << duration.max();
+	lateness.reset();
+	duration.reset();
+}
@@ -0,0 +1,46 @@
+#ifndef TICKER_HPP
+#define TICKER_HPP
+
+#include "stats.hpp"
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+namespace game_logic
+{
+	class game;
+
+	/* Ticks one game on a dedicated thread, so an overloaded field cannot delay the others */
+	class ticker
+	{
+		public:
+			typedef std::function<void(int)> cb_t;
+
+			ticker(int _field, const std::shared_ptr<game>& _game, std::chrono::milliseconds _period);
+			~ticker();
+
+			/* Called on the tick thread after every tick with the new tick number */
+			void set_cb(const cb_t& _cb);
+			void start();
+
+			/* How late ticks start against the schedule, and how long they take */
+			const latency_histogram& get_lateness() const;
+			const latency_histogram& get_duration() const;
+
+		private:
+			int field;
+			std::shared_ptr<game> g;
+			std::chrono::milliseconds period;
+			cb_t cb;
+			latency_histogram lateness, duration;
+			std::atomic<bool> stop;
+			std::thread thread;
+
+			void run();
+			void report();
+	};
+}
+
+#endif
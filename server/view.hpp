@@ -0,0 +1,133 @@
+#ifndef VIEW_HPP
+#define VIEW_HPP
+
+#include "game.hpp"
+#include <vector>
+
+namespace network
+{
+	/* The snakes a package is built for: everything near the head of any of them is
+	   visible. The first one is the snake the package is about. */
+	typedef std::vector<const game_logic::snake*> own_snakes;
+
+	inline float view_radius(const game_logic::snake& s)
+	{
+		return 100 * s.r;
+	}
+
+	/* Calls f(k) for every visible point k of snake s, in order */
+	template<class F>
+	void visible_points(const game_logic::field& field, size_t s, const own_snakes& own, F f)
+	{
+		if (own.size() == 1)
+		{
+			field.columns.within(s, own[0]->skeleton[0], game_logic::sqr(view_radius(*own[0])), f);
+			return;
+		}
+		std::vector<char> seen(field.snakes[s].skeleton.size());
+		bool any = false;
+		for (auto i : own)
+		{
+			field.columns.within(s, i->skeleton[0], game_logic::sqr(view_radius(*i)), [&](size_t k)
+				{
+					seen[k] = any = true;
+				});
+		}
+		for (size_t k = 0; any && k < seen.size(); ++k)
+		{
+			if (seen[k])
+			{
+				f(k);
+			}
+		}
+	}
+
+	/* Level of detail of far skeletons. Points farther than distance radii of the
+	   receiving snake from every own head are thinned to about one per spacing radii
+	   of their own snake; nearer points and both ends of every visible run are sent
+	   as they are. A distance of 0 sends every point. */
+	struct skeleton_lod
+	{
+		float distance = 0;
+		float spacing = 2;
+	};
+
+	/* visible_points with far points thinned by lod; the points kept stay in order */
+	template<class F>
+	void lod_points(const game_logic::field& field, size_t s, const own_snakes& own, const skeleton_lod& lod, F f)
+	{
+		if (!(lod.distance > 0))
+		{
+			visible_points(field, s, own, f);
+			return;
+		}
+		const game_logic::snake &j = field.snakes[s];
+		float spacing2 = game_logic::sqr(lod.spacing * j.r);
+		/* The last far point skipped; it is sent when it ends a run */
+		size_t held = 0, prev = 0;
+		bool holding = false, any = false;
+		game_logic::point kept;
+		visible_points(field, s, own, [&](size_t k)
+			{
+				const game_logic::point &p = j.skeleton[k];
+				bool start = !any || k != prev + 1;
+				if (start && holding)
+				{
+					f(held);
+					holding = false;
+				}
+				any = true;
+				prev = k;
+				bool near = false;
+				for (size_t c = 0; c < own.size() && !near; ++c)
+				{
+					near = (p - own[c]->skeleton[0]).dist2() < game_logic::sqr(lod.distance * own[c]->r);
+				}
+				if (near || start || !((p - kept).dist2() < spacing2))
+				{
+					f(k);
+					kept = p;
+					holding = false;
+				}
+				else
+				{
+					held = k;
+					holding = true;
+				}
+			});
+		if (holding)
+		{
+			f(held);
+		}
+	}
+
+	/* Calls f(idx) once for every visible food, in no particular order */
+	template<class F>
+	void visible_foods(const game_logic::field& field, const own_snakes& own, F f)
+	{
+		for (size_t c = 0; c < own.size(); ++c)
+		{
+			game_logic::point head = own[c]->skeleton[0];
+			float radius = view_radius(*own[c]);
+			field.food_index.query(head, radius, [&](const game_logic::grid::entry& e) -> bool
+				{
+					if (!((e.p - head).dist2() < game_logic::sqr(radius)))
+					{
+						return false;
+					}
+					/* Seen through an earlier snake already */
+					for (size_t d = 0; d < c; ++d)
+					{
+						if ((e.p - own[d]->skeleton[0]).dist2() < game_logic::sqr(view_radius(*own[d])))
+						{
+							return false;
+						}
+					}
+					f(e.idx);
+					return false;
+				});
+		}
+	}
+}
+
+#endif